@@ -0,0 +1,180 @@
+#include <adaptive_allocator.h>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+using namespace wheels;
+
+static bool _cmp_bsize(const allocator_t::allocator_info_t& l, const allocator_t::allocator_info_t& r)
+{
+    return l.bsize_ < r.bsize_;
+}
+
+adaptive_allocator_t::adaptive_allocator_t():
+    classes_(NULL), cnum_(0)
+{
+}
+
+adaptive_allocator_t::~adaptive_allocator_t()
+{
+    // slabs go back to reserve before it is destructed
+    if (classes_)
+    {
+        delete []classes_;
+        classes_ = NULL;
+    }
+
+    cnum_ = 0;
+}
+
+int adaptive_allocator_t::initialize( allocator_t::allocator_info_t* classes, size_t reserve_size,
+    const slab_allocator_t::option_t& opt )
+{
+    if (NULL == classes || classes_)
+    {
+        return -1;
+    }
+
+    size_t num = 0;
+    while (classes[num].bsize_ != 0)
+    {
+        ++num;
+    }
+
+    if (0 == num || num > slab_reserve_t::MAX_CLIENT)
+    {
+        return -1;
+    }
+
+    size_t slab_num = (reserve_size + opt.slab_size_ - 1) / opt.slab_size_;
+    int policy = (slab_allocator_t::release_none == opt.policy_)? slab_allocator_t::release_none
+        : slab_allocator_t::release_madvise;
+    int ret = reserve_.initialize(opt.slab_size_, slab_num, opt.page_, policy);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    std::sort(&classes[0], &classes[num], _cmp_bsize);
+    classes_ = new slab_allocator_t[num];
+    if (NULL == classes_)
+    {
+        return -1;
+    }
+
+    cnum_ = num;
+    slab_allocator_t::option_t copt = opt;
+    copt.reserve_ = &reserve_;
+    for (size_t i = 0; i < num; ++i)
+    {
+        ret = classes_[i].initialize(classes[i].bsize_, copt);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int adaptive_allocator_t::get_class( size_t sz ) const
+{
+    // binary search
+    int start = 0, end = cnum_ - 1;
+    while (end >= start)
+    {
+        int mid = (start + end) / 2;
+        if (classes_[mid].get_bsize() < sz)
+        {
+            start = mid + 1;
+        }
+        else
+        {
+            end = mid - 1;
+        }
+    }
+
+    return (start < (int)cnum_)? start: -1;
+}
+
+slab_allocator_t* adaptive_allocator_t::get_owner( void* p ) const
+{
+    if (!reserve_.is_owner(p))
+    {
+        return NULL;
+    }
+
+    return slab_allocator_t::get_owner(p, reserve_.get_slab_size());
+}
+
+void* adaptive_allocator_t::alloc( size_t sz )
+{
+    int cls = get_class(sz);
+    if (cls < 0)
+    {
+        return NULL;
+    }
+
+    // spill to larger classes only if reserve has nothing for this one
+    for (size_t i = cls; i < cnum_; ++i)
+    {
+        void* p = classes_[i].alloc();
+        if (p)
+        {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+int adaptive_allocator_t::free( void* p )
+{
+    if (NULL == p)
+    {
+        return 0;
+    }
+
+    slab_allocator_t* owner = get_owner(p);
+    if (NULL == owner)
+    {
+        return -1;
+    }
+
+    return owner->free(p);
+}
+
+size_t adaptive_allocator_t::get_usable_size( void* p ) const
+{
+    slab_allocator_t* owner = get_owner(p);
+    return owner? owner->get_bsize(): 0;
+}
+
+void* adaptive_allocator_t::realloc( size_t sz, void* p )
+{
+    size_t usable = get_usable_size(p);
+    if (0 == usable)
+    {
+        return NULL;
+    }
+
+    if (usable >= sz)
+    {
+        return p;
+    }
+
+    void* n = alloc(sz);
+    if (NULL == n)
+    {
+        return NULL;
+    }
+
+    memcpy(n, p, usable);
+    if (free(p) < 0)
+    {
+        // this should never happen
+        abort();
+    }
+
+    return n;
+}
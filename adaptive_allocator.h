@@ -0,0 +1,57 @@
+#ifndef _WHEELS_ADAPTIVE_ALLOCATOR_H_
+#define _WHEELS_ADAPTIVE_ALLOCATOR_H_
+
+#include <allocator.h>
+#include <slab_allocator.h>
+
+namespace wheels
+{
+    /*
+     *	size classes without fixed capacity, same api as allocator_t, not thread-safe
+     *  every class is a slab_allocator_t drawing slabs from one shared slab_reserve_t.
+     *  empty slabs go back to the reserve, and are reclaimed from idle classes when it runs out,
+     *  so memory follows the traffic mix. blocks have no head, owner class is found by slab
+     */
+    class adaptive_allocator_t
+    {
+    public:
+        adaptive_allocator_t();
+        ~adaptive_allocator_t();
+
+        // alloc one block, return the address
+        void* alloc(size_t sz);
+        // dealloc one block, return < 0 if error
+        int free(void* p);
+        // realloc, return NULL if oom or error(you can still use p), non-NULL if succ, coredump if fatal
+        void* realloc(size_t sz, void* p);
+
+        /*
+         *	classes: bsize_ of each class, capacity_ is ignored, ends with bsize_ == 0.
+         *  reserve_size: bytes shared by all classes. opt: slab options of every class
+         */
+        int initialize(allocator_t::allocator_info_t* classes, size_t reserve_size,
+            const slab_allocator_t::option_t& opt = slab_allocator_t::option_t());
+        // true if p is inside the reserve
+        bool is_owner(void* p) const { return reserve_.is_owner(p); }
+        // usable bytes of block p, 0 if p is invalid
+        size_t get_usable_size(void* p) const;
+
+        size_t get_class_num() const { return cnum_; }
+        const slab_allocator_t& get_class(int cls) const { return classes_[cls]; }
+        const slab_reserve_t& get_reserve() const { return reserve_; }
+
+    private:
+        // deny copy-cons
+        adaptive_allocator_t(const adaptive_allocator_t& c);
+        // return min class which can hold sz bytes, -1 if sz is larger than all classes
+        int get_class(size_t sz) const;
+        // owner class of block p, NULL if p is not ours
+        slab_allocator_t* get_owner(void* p) const;
+
+        slab_reserve_t reserve_;
+        slab_allocator_t* classes_;     // sorted by bsize
+        size_t cnum_;
+    };
+}
+
+#endif
@@ -1,14 +1,33 @@
 #include <allocator.h>
+#include <size_profile.h>
+#include <page_alloc.h>
 #include <cstdlib>
+#include <cstring>
 #include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace wheels;
 
 const int allocator_t::MAGIC_GUARD = 0x343;
+const int allocator_t::MAGIC_SAMPLED = 0x344;
+const int allocator_t::MAGIC_ALIGNED = 0x345;
+const int allocator_t::MAGIC_LARGE = 0x346;
+const int allocator_t::MAGIC_CACHED = 0x347;
+const uint64_t allocator_t::SPAN_MAGIC = 0x776865656c736c67ULL;
+const size_t allocator_t::LARGE_HEAD_SIZE = 64;
+const size_t allocator_t::LARGE_CACHE_SIZE = 32 << 20;
+const size_t allocator_t::ROUTE_MAX_SIZE = 32768;
+// bumped when the file layout changes
+const uint64_t fixed_size_allocator_t::MMAP_MAGIC = 0x776865656c736663ULL;
 
 fixed_size_allocator_t::fixed_size_allocator_t():
-    bsize_(0), capacity_(0), bqueue_(NULL), data_(NULL)
+    bsize_(0), capacity_(0), bqueue_(NULL), data_(NULL), heap_(NULL),
+    mbase_(NULL), msize_(0), attached_(false), policy_(reuse_fifo), free_bits_(NULL), free_sum_(NULL)
 {
+    memset(&stats_, 0, sizeof(stats_));
 
 }
 
@@ -20,12 +39,34 @@ fixed_size_allocator_t::~fixed_size_allocator_t()
         bqueue_ = NULL;
     }
 
-    if (data_)
+    if (mbase_)
     {
-        delete [](char*)data_;
+        page_unmap(mbase_, msize_);
+        mbase_ = NULL;
+        msize_ = 0;
         data_ = NULL;
     }
-    
+
+    if (heap_)
+    {
+        delete []heap_;
+        heap_ = NULL;
+    }
+
+    if (free_bits_)
+    {
+        delete []free_bits_;
+        free_bits_ = NULL;
+    }
+
+    if (free_sum_)
+    {
+        delete []free_sum_;
+        free_sum_ = NULL;
+    }
+
+    data_ = NULL;
+
     bsize_ = 0;
     capacity_ = 0;
 }
@@ -38,37 +79,232 @@ int fixed_size_allocator_t::initialize( size_t bsize, size_t capacity )
     }
 
     bqueue_ = new block_mqueue_t(capacity, 2);
-    data_ = new char[bsize*capacity];
-    if (NULL == bqueue_ || NULL == data_)
+    heap_ = new char[bsize * capacity + DATA_ALIGN];
+    if (NULL == bqueue_ || NULL == heap_)
+    {
+        return -1;
+    }
+
+    data_ = (void*)(((uintptr_t)heap_ + DATA_ALIGN - 1) & ~(uintptr_t)(DATA_ALIGN - 1));
+
+    bsize_ = bsize;
+    capacity_ = capacity;
+    return 0;
+}
+
+int fixed_size_allocator_t::initialize( size_t bsize, size_t capacity, const page_option_t& opt )
+{
+    if (bqueue_ || bsize <= 0 || capacity <= 0)
+    {
+        return -1;
+    }
+
+    // queue metadata is touched by every alloc/free too, map it with blocks
+    size_t qsize = block_mqueue_t::calc_mem_size(capacity, 2);
+    size_t gran = (huge_none == opt.huge_)? page_size(): huge_page_size();
+    if (0 == gran)
     {
         return -1;
     }
 
-    char* p = (char*)data_;
-    for (block_mqueue_t::iterator_t it = bqueue_->begin(q_free); 
-        it != bqueue_->end(q_free); ++it)
+    size_t total = (qsize + bsize * capacity + gran - 1) / gran * gran;
+    void* base = page_map(total, gran, opt);
+    if (NULL == base)
     {
-        it->flag_ = block_none;
-        it->data_ = p;
-        p += bsize;
+        return -1;
     }
 
+    mbase_ = base;
+    msize_ = total;
+    bsize_ = bsize;
+    capacity_ = capacity;
+    data_ = (char*)base + qsize;
+    bqueue_ = new block_mqueue_t(base, capacity, 2, false);
     return 0;
 }
 
-void* fixed_size_allocator_t::alloc()
+int fixed_size_allocator_t::initialize( size_t bsize, size_t capacity, const char* path )
+{
+    if (bqueue_ || bsize <= 0 || capacity <= 0 || NULL == path)
+    {
+        return -1;
+    }
+
+    // keep queue metadata and blocks cache line aligned
+    size_t hsize = (sizeof(mmap_head_t) + 63) & ~(size_t)63;
+    size_t qsize = block_mqueue_t::calc_mem_size(capacity, 2);
+    size_t total = hsize + qsize + bsize * capacity;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (st.st_size != 0 && (size_t)st.st_size != total)
+        || (0 == st.st_size && ftruncate(fd, total) < 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    void* base = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == base)
+    {
+        return -1;
+    }
+
+    mmap_head_t* head = (mmap_head_t*)base;
+    attached_ = (MMAP_MAGIC == head->magic_);
+    if (attached_ && (head->bsize_ != bsize || head->capacity_ != capacity))
+    {
+        // same size but different layout
+        munmap(base, total);
+        attached_ = false;
+        return -1;
+    }
+
+    mbase_ = base;
+    msize_ = total;
+    bsize_ = bsize;
+    capacity_ = capacity;
+    data_ = (char*)base + hsize + qsize;
+    bqueue_ = new block_mqueue_t((char*)base + hsize, capacity, 2, attached_);
+    if (!attached_)
+    {
+        head->bsize_ = bsize;
+        head->capacity_ = capacity;
+        // mark it valid at last, a half-initialized file will be initialized again
+        head->magic_ = MMAP_MAGIC;
+    }
+
+    return 0;
+}
+
+void fixed_size_allocator_t::reset()
+{
+    bqueue_->reset();
+    if (free_bits_)
+    {
+        memset(free_bits_, 0, (capacity_ + 63) / 64 * sizeof(uint64_t));
+        memset(free_sum_, 0, ((capacity_ + 63) / 64 + 63) / 64 * sizeof(uint64_t));
+    }
+}
+
+int fixed_size_allocator_t::set_reuse_policy( int policy )
+{
+    if (NULL == bqueue_ || policy < reuse_fifo || policy > reuse_lowest)
+    {
+        return -1;
+    }
+
+    if (reuse_lowest == policy && reuse_lowest != policy_)
+    {
+        size_t wnum = (capacity_ + 63) / 64;
+        size_t snum = (wnum + 63) / 64;
+        if (NULL == free_bits_)
+        {
+            free_bits_ = new uint64_t[wnum];
+            free_sum_ = new uint64_t[snum];
+            if (NULL == free_bits_ || NULL == free_sum_)
+            {
+                return -1;
+            }
+        }
+
+        // freed blocks so far, never-used ones are taken after them anyway
+        memset(free_bits_, 0, wnum * sizeof(uint64_t));
+        memset(free_sum_, 0, snum * sizeof(uint64_t));
+        for (int id = bqueue_->get_head(q_free); id >= 0; id = bqueue_->get_next_id(id))
+        {
+            set_free_bit(id);
+        }
+    }
+
+    policy_ = policy;
+    return 0;
+}
+
+int fixed_size_allocator_t::find_lowest_free() const
+{
+    // one summary word covers 4096 blocks
+    size_t snum = ((capacity_ + 63) / 64 + 63) / 64;
+    for (size_t i = 0; i < snum; ++i)
+    {
+        if (free_sum_[i])
+        {
+            size_t w = i * 64 + __builtin_ctzll(free_sum_[i]);
+            return w * 64 + __builtin_ctzll(free_bits_[w]);
+        }
+    }
+
+    return -1;
+}
+
+int fixed_size_allocator_t::alloc_idx()
+{
+    int id = -1;
+    if (reuse_lifo == policy_)
+    {
+        id = bqueue_->get_head(q_free);
+    }
+    else if (reuse_lowest == policy_)
+    {
+        id = find_lowest_free();
+    }
+
+    // fifo or nothing freed, take head of q_free, which are never-used blocks first
+    if (id < 0)
+    {
+        return (bqueue_->append(q_used) < 0)? -1: bqueue_->get_tail(q_used);
+    }
+
+    if (reuse_lowest == policy_)
+    {
+        clear_free_bit(id);
+    }
+
+    if (bqueue_->move_node(id, q_used) < 0)
+    {
+        // FATAL: should never happen!
+        abort();
+    }
+
+    return id;
+}
+
+void fixed_size_allocator_t::free_idx( int id )
 {
-    int ret = bqueue_->append(q_used);
+    bqueue_->get(id)->flag_ &= (uint32_t)(~(block_used | block_inner | block_cached));
+    int ret = (reuse_lifo == policy_)? bqueue_->move_node_head(id, q_free): bqueue_->move_node(id, q_free);
     if (ret < 0)
+    {
+        // FATAL: should never happen!
+        abort();
+    }
+
+    if (reuse_lowest == policy_)
+    {
+        set_free_bit(id);
+    }
+}
+
+void* fixed_size_allocator_t::alloc()
+{
+    int id = alloc_idx();
+    if (id < 0)
     {
         // out of memory
+        W_ALLOC_STAT(stat_alloc(0, 1));
         return NULL;
     }
 
-    int id = bqueue_->get_tail(q_used);
     block_t* b = bqueue_->get(id);
     b->flag_ |= block_used;
-    return b->data_;
+    W_ALLOC_STAT(stat_alloc(1, 0));
+    return idx_to_address(id);
 }
 
 int fixed_size_allocator_t::free( void* p )
@@ -78,39 +314,152 @@ int fixed_size_allocator_t::free( void* p )
         return 0;
     }
 
-    size_t id = address_to_idx(p);
-    block_t* b = bqueue_->get(id);
-    if (NULL == b || b->data_ != p || block_used != (b->flag_ & block_used))
+    int id = get_used_idx(p);
+    if (id < 0)
     {
         return -1;
     }
 
-    int ret = bqueue_->swap(id, bqueue_->get_head(q_used));
-    if (ret < 0)
+    free_idx(id);
+    W_ALLOC_STAT(++stats_.free_num_);
+    return 0;
+}
+
+size_t fixed_size_allocator_t::alloc_batch( size_t n, void** out )
+{
+    if (reuse_fifo != policy_)
     {
-        // FATAL: should never happen!
-        abort();
+        // blocks are picked one by one
+        size_t num = 0;
+        int id;
+        while (num < n && (id = alloc_idx()) >= 0)
+        {
+            bqueue_->get(id)->flag_ |= block_used;
+            out[num++] = idx_to_address(id);
+        }
+
+        W_ALLOC_STAT(stat_alloc(num, (num < n)? 1: 0));
+        return num;
     }
 
-    b->flag_ &= (uint32_t)(~block_used);
-    if (bqueue_->remove(q_used) < 0)
+    int num = bqueue_->move_n(q_free, q_used, (n < (size_t)capacity_)? n: capacity_);
+    if (num < 0)
     {
         // FATAL: should never happen!
         abort();
     }
 
+    // moved blocks are at the tail of used queue
+    int id = bqueue_->get_tail(q_used);
+    for (int i = num - 1; i >= 0; --i)
+    {
+        bqueue_->get(id)->flag_ |= block_used;
+        out[i] = idx_to_address(id);
+        id = bqueue_->get_prev_id(id);
+    }
+
+    W_ALLOC_STAT(stat_alloc(num, ((size_t)num < n)? 1: 0));
+    return num;
+}
+
+int fixed_size_allocator_t::mark_inner( void* p )
+{
+    int id = get_used_idx(p);
+    if (id < 0)
+    {
+        return -1;
+    }
+
+    bqueue_->get(id)->flag_ |= block_inner;
+    return 0;
+}
+
+int fixed_size_allocator_t::mark_cached( void* p )
+{
+    int id = get_used_idx(p);
+    if (id < 0 || idx_to_address(id) != p)
+    {
+        return -1;
+    }
+
+    bqueue_->get(id)->flag_ |= block_cached;
     return 0;
 }
 
+int fixed_size_allocator_t::free_batch( size_t n, void** ptrs )
+{
+    int ret = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (NULL == ptrs[i])
+        {
+            continue;
+        }
+
+        int id = get_used_idx(ptrs[i]);
+        if (id < 0)
+        {
+            ret = -1;
+            continue;
+        }
+
+        free_idx(id);
+
+        W_ALLOC_STAT(++stats_.free_num_);
+    }
+
+    return ret;
+}
+
+void fixed_size_allocator_t::get_stats( stats_t& st ) const
+{
+    st = stats_;
+    st.used_num_ = bqueue_? get_used_num(): 0;
+}
+
+void fixed_size_allocator_t::reset_stats()
+{
+    memset(&stats_, 0, sizeof(stats_));
+    stats_.peak_used_num_ = bqueue_? get_used_num(): 0;
+}
+
+int fixed_size_allocator_t::get_used_idx( void* p )
+{
+    if ((char*)p < (char*)data_)
+    {
+        return -1;
+    }
+
+    size_t id = address_to_idx(p);
+    block_t* b = (id < (size_t)capacity_)? bqueue_->get(id): NULL;
+    // blocks held by a front-end cache are freed already
+    if (NULL == b || block_used != (b->flag_ & (block_used | block_cached))
+        || (idx_to_address(id) != p && 0 == (b->flag_ & block_inner)))
+    {
+        return -1;
+    }
+
+    return id;
+}
+
 //////////////////////////////////////////////////////////////////////////
+// usable bytes of class, rounded up to its alignment
+static size_t _class_size(const allocator_t::allocator_info_t& a)
+{
+    return (a.align_ > 1)? (a.bsize_ + a.align_ - 1) & ~(a.align_ - 1): a.bsize_;
+}
+
 bool _cmp_allocinfo(const allocator_t::allocator_info_t& l, const allocator_t::allocator_info_t& r)
 {
-    return l.bsize_ < r.bsize_;
+    return _class_size(l) < _class_size(r);
 }
 
 allocator_t::allocator_t():
-    allocators_(NULL), anum_(0)
+    allocators_(NULL), anum_(0), hsize_(sizeof(block_head_t)), classes_(NULL), ranges_(NULL), route_(NULL), route_max_(0), route_mask_(0), route_shift_(0),
+    free_classes_(NULL), stats_(NULL), profiler_(NULL), size_profile_(NULL), page_mask_(0), large_live_(NULL),
+    large_cache_(NULL), large_cache_max_(LARGE_CACHE_SIZE), sample_left_(INT64_MAX)
 {
+    memset(&large_stats_, 0, sizeof(large_stats_));
 }
 
 allocator_t::~allocator_t()
@@ -120,103 +469,236 @@ allocator_t::~allocator_t()
         delete []allocators_;
         allocators_ = NULL;
     }
-    
+
+    if (route_)
+    {
+        delete []route_;
+        route_ = NULL;
+    }
+
+    if (free_classes_)
+    {
+        delete []free_classes_;
+        free_classes_ = NULL;
+    }
+
+    if (classes_)
+    {
+        delete []classes_;
+        classes_ = NULL;
+    }
+
+    if (ranges_)
+    {
+        delete []ranges_;
+        ranges_ = NULL;
+    }
+
+    if (stats_)
+    {
+        delete []stats_;
+        stats_ = NULL;
+    }
+
+    // spans still in use go away with the pools
+    while (large_live_)
+    {
+        span_head_t* h = large_live_;
+        unlink_span(large_live_, h);
+        page_unmap(h->base_, h->size_);
+    }
+
+    trim_cache(0);
     anum_ = 0;
 }
 
-int allocator_t::initialize( allocator_info_t* allocators )
+int allocator_t::initialize( allocator_info_t* allocators, int flags, const page_option_t* popt )
 {
-    if (NULL == allocators)
+    if (NULL == allocators || allocators_)
     {
         return -1;
     }
 
+    hsize_ = (flags & alloc_headless)? 0: sizeof(block_head_t);
     anum_ = 0;
     for (int i = 0; allocators[i].bsize_ != 0; ++i)
     {
+        size_t align = allocators[i].align_;
+        if (align > MAX_CLASS_ALIGN || 0 != (align & (align - 1)))
+        {
+            return -1;
+        }
+
         ++anum_;
     }
 
-    std::sort(&allocators[0], &allocators[anum_ -1], _cmp_allocinfo);
+    // class index must fit in route table
+    if (anum_ > INT16_MAX)
+    {
+        return -1;
+    }
+
+    std::sort(&allocators[0], &allocators[anum_], _cmp_allocinfo);
     allocators_ = new fixed_size_allocator_t[anum_];
-    if (NULL == allocators_)
+    free_classes_ = new uint64_t[(anum_ + 63) / 64];
+    classes_ = new class_info_t[anum_];
+    if (NULL == allocators_ || NULL == free_classes_ || NULL == classes_)
     {
         return -1;
     }
 
+    memset(free_classes_, 0, (anum_ + 63) / 64 * sizeof(uint64_t));
+    stats_ = new class_stats_t[anum_];
+    memset(stats_, 0, anum_ * sizeof(class_stats_t));
+
     int ret;
     for (size_t i = 0; i < anum_; ++i)
     {
-        ret = allocators_[i].initialize(allocators[i].bsize_+sizeof(block_head_t), allocators[i].capacity_);
+        // pad head to alignment, so payloads stay aligned when blocks are laid back to back
+        size_t align = allocators[i].align_;
+        size_t prefix = (align > 1)? (hsize_ + align - 1) & ~(align - 1): hsize_;
+        size_t bsize = prefix + _class_size(allocators[i]);
+        size_t bits = bsize | prefix | MAX_CLASS_ALIGN;
+        classes_[i].hsize_ = prefix;
+        classes_[i].align_ = bits & (~bits + 1);
+        ret = popt? allocators_[i].initialize(bsize, allocators[i].capacity_, *popt)
+            : allocators_[i].initialize(bsize, allocators[i].capacity_);
         if (ret < 0)
         {
             return ret;
         }
+
+        mark_free_class(i, true);
+    }
+
+    init_route();
+    init_ranges();
+    if (flags & alloc_large)
+    {
+        page_mask_ = page_size() - 1;
+        large_page_ = popt? *popt: page_option_t();
+        // mremap of hugetlb spans is not portable
+        if (huge_explicit == large_page_.huge_)
+        {
+            large_page_.huge_ = huge_transparent;
+        }
     }
 
     return 0;
 }
 
-fixed_size_allocator_t* allocator_t::get_allocator( size_t bsize )
+void allocator_t::init_ranges()
 {
-    int start = 0, end = anum_ -1;
-    int mid = (start + end) / 2;
-    while (end >= start)
+    ranges_ = new range_t[anum_];
+    for (size_t i = 0; i < anum_; ++i)
     {
-        fixed_size_allocator_t& fa = allocators_[mid];
+        ranges_[i].begin_ = (uintptr_t)allocators_[i].get_data();
+        ranges_[i].end_ = ranges_[i].begin_ + allocators_[i].get_data_size();
+        ranges_[i].cls_ = i;
+    }
 
-        if (fa.get_bsize() == bsize)
-        {
-            return &fa;
-        }
+    std::sort(&ranges_[0], &ranges_[anum_]);
+}
 
-        if (bsize < fa.get_bsize())
+int allocator_t::get_range_class( void* p ) const
+{
+    uintptr_t addr = (uintptr_t)p;
+    int start = 0, end = anum_ - 1;
+    while (end >= start)
+    {
+        int mid = (start + end) / 2;
+        const range_t& r = ranges_[mid];
+        if (addr < r.begin_)
         {
             end = mid - 1;
         }
-        else
+        else if (addr >= r.end_)
         {
             start = mid + 1;
         }
+        else
+        {
+            return r.cls_;
+        }
     }
 
-    return NULL;
+    return -1;
 }
 
-fixed_size_allocator_t* allocator_t::find_best_allocator( size_t bsize )
+void allocator_t::init_route()
 {
-    int id = get_ceiling_allocator(bsize);
-    if (id < 0)
+    // use 8 bytes granularity if it does not change any class boundary
+    route_shift_ = 3;
+    for (size_t i = 0; i < anum_; ++i)
     {
-        return NULL;
+        if (0 != get_class_size(i) % 8)
+        {
+            route_shift_ = 0;
+            break;
+        }
+    }
+
+    route_mask_ = ((size_t)1 << route_shift_) - 1;
+    route_max_ = (anum_ > 0)? get_class_size(anum_ - 1): 0;
+    if (route_max_ > ROUTE_MAX_SIZE)
+    {
+        route_max_ = ROUTE_MAX_SIZE;
     }
 
-    for (size_t i = id; i < anum_; ++i)
+    size_t num = ((route_max_ + route_mask_) >> route_shift_) + 1;
+    route_ = new int16_t[num];
+    int cls = 0;
+    for (size_t i = 0; i < num; ++i)
     {
-        if (allocators_[i].get_free_num() > 0)
+        size_t sz = i << route_shift_;
+        while (cls < (int)anum_ && get_class_size(cls) < sz)
         {
-            return &allocators_[i];
+            ++cls;
         }
+
+        route_[i] = (cls < (int)anum_)? cls: -1;
     }
+}
 
-    return NULL;
+int allocator_t::find_best_class( size_t sz ) const
+{
+    int cls = get_class(sz);
+    if (cls < 0)
+    {
+        return -1;
+    }
+
+    size_t wnum = (anum_ + 63) / 64;
+    size_t w = cls / 64;
+    uint64_t bits = free_classes_[w] & (~(uint64_t)0 << (cls % 64));
+    while (0 == bits)
+    {
+        if (++w >= wnum)
+        {
+            return -1;
+        }
+
+        bits = free_classes_[w];
+    }
+
+    return w * 64 + __builtin_ctzll(bits);
 }
 
-int allocator_t::get_ceiling_allocator( size_t bsize ) const
+int allocator_t::get_ceiling_class( size_t sz ) const
 {
     // binary search
     int start = 0, end = anum_ -1;
-    int mid = (start + end) / 2;
     while (end >= start)
     {
-        fixed_size_allocator_t& fa = allocators_[mid];
+        int mid = (start + end) / 2;
+        size_t csize = get_class_size(mid);
 
-        if (fa.get_bsize() == bsize || (fa.get_bsize() > bsize && less_bsize(mid-1, bsize)))
+        if (csize == sz || (csize > sz && less_size(mid-1, sz)))
         {
             return mid;
         }
 
-        if (bsize < fa.get_bsize())
+        if (sz < csize)
         {
             end = mid - 1;
         }
@@ -231,21 +713,70 @@ int allocator_t::get_ceiling_allocator( size_t bsize ) const
 
 void* allocator_t::alloc( size_t sz )
 {
-    fixed_size_allocator_t* fa = find_best_allocator(sz+sizeof(block_head_t));
-    if (NULL == fa)
+    int cls = find_best_class(sz);
+    if (cls < 0)
     {
+        if (is_large(sz))
+        {
+            return alloc_span(sz, 0);
+        }
+
+        W_ALLOC_STAT(stat_alloc(sz, 0, -1));
         return NULL;
     }
 
-    block_head_t* bh = (block_head_t*)fa->alloc();
-    if (bh)
+    W_ALLOC_STAT(stat_alloc(sz, 1, cls));
+    void* p = alloc_class(cls);
+    on_alloc(p, sz);
+    return p;
+}
+
+void* allocator_t::alloc_aligned( size_t sz, size_t align )
+{
+    if (0 == align || 0 != (align & (align - 1)))
     {
-        bh->asize_ = fa->get_bsize();
-        bh->guard_ = MAGIC_GUARD;
-        return bh->data_;
+        return NULL;
     }
 
-    return NULL;
+    // smallest class aligned enough
+    int cls = get_class(sz);
+    for (int i = (cls < 0)? anum_: cls; i < (int)anum_; ++i)
+    {
+        if (classes_[i].align_ >= align && allocators_[i].get_free_num() > 0)
+        {
+            W_ALLOC_STAT(stat_alloc(sz, 1, i));
+            void* p = alloc_class(i);
+            on_alloc(p, sz);
+            return p;
+        }
+    }
+
+    // over-allocate, leave room for a head in front of aligned pointer
+    if (is_large(sz + align + hsize_))
+    {
+        return alloc_span(sz, align);
+    }
+
+    char* raw = (char*)alloc(sz + align + hsize_);
+    if (NULL == raw || 0 == ((uintptr_t)raw & (align - 1)))
+    {
+        return raw;
+    }
+
+    char* p = (char*)(((uintptr_t)raw + hsize_ + align - 1) & ~(uintptr_t)(align - 1));
+    if (hsize_ > 0)
+    {
+        block_head_t* bh = (block_head_t*)(p - offsetof(block_head_t, data_));
+        bh->guard_ = MAGIC_ALIGNED;
+        bh->cls_ = p - raw;
+    }
+    else if (allocators_[get_range_class(raw)].mark_inner(raw) < 0)
+    {
+        // FATAL: should never happen!
+        abort();
+    }
+
+    return p;
 }
 
 int allocator_t::free( void* p )
@@ -255,30 +786,332 @@ int allocator_t::free( void* p )
         return 0;
     }
 
+    p = unalign(p);
+    int cls = get_block_class(p);
+    if (cls < 0)
+    {
+        span_head_t* h = get_span(p);
+        return h? free_span(h): -1;
+    }
+
+    on_free(p, cls);
+    int ret = allocators_[cls].free(dataptr2block(p, cls));
+    if (0 == ret)
+    {
+        mark_free_class(cls, true);
+    }
+
+    return ret;
+}
+
+int allocator_t::get_block_class( void* p )
+{
+    if (0 == hsize_)
+    {
+        return get_range_class(p);
+    }
+
     block_head_t* bh = dataptr2bhead(p);
-    if (NULL == bh)
+    if (NULL == bh || bh->cls_ < 0 || bh->cls_ >= (int)anum_)
     {
         return -1;
     }
 
-    fixed_size_allocator_t* fa = get_allocator(bh->asize_);
-    if (NULL == fa)
+    return bh->cls_;
+}
+
+int allocator_t::mark_cached( void* p )
+{
+    if (0 == hsize_)
+    {
+        int cls = get_range_class(p);
+        if (cls < 0 || allocators_[cls].get_block(p) != p)
+        {
+            return -1;
+        }
+
+#ifdef WHEELS_ALLOCATOR_DEBUG
+        // shared block flags, too costly for the fast path
+        if (allocators_[cls].mark_cached(p) < 0)
+        {
+            return -1;
+        }
+#endif
+        return cls;
+    }
+
+    // sampled and aligned blocks are not plain, their owner frees them
+    block_head_t* bh = (block_head_t*)((char*)p - offsetof(block_head_t, data_));
+    if (MAGIC_GUARD != bh->guard_ || bh->cls_ < 0 || bh->cls_ >= (int)anum_)
     {
         return -1;
     }
 
-    return fa->free(p);
+    bh->guard_ = MAGIC_CACHED;
+    return bh->cls_;
 }
 
-void* allocator_t::realloc( size_t sz, void* p )
+void* allocator_t::alloc_class( int cls )
 {
-    block_head_t* bh = dataptr2bhead(p);
-    if (NULL == bh)
+    if (cls < 0 || cls >= (int)anum_)
     {
         return NULL;
     }
 
-    if (bh->asize_ >= (int)(sz + sizeof(block_head_t)))
+    fixed_size_allocator_t& fa = allocators_[cls];
+    void* b = fa.alloc();
+    if (0 == fa.get_free_num())
+    {
+        mark_free_class(cls, false);
+    }
+
+    return block2dataptr(b, cls);
+}
+
+size_t allocator_t::alloc_batch( size_t sz, size_t n, void** out )
+{
+    size_t num = 0;
+    if (is_large(sz))
+    {
+        // one span each
+        for (; num < n; ++num)
+        {
+            out[num] = alloc_span(sz, 0);
+            if (NULL == out[num])
+            {
+                break;
+            }
+        }
+
+        return num;
+    }
+
+    while (num < n)
+    {
+        int cls = find_best_class(sz);
+        if (cls < 0)
+        {
+            W_ALLOC_STAT(stat_alloc(sz, 0, -1));
+            break;
+        }
+
+        size_t got = take_class_batch(cls, n - num, out + num);
+        W_ALLOC_STAT(stat_alloc(sz, got, cls));
+        if (got > 0 && (sample_left_ -= sz * got) < 0)
+        {
+            // one sample per batch
+            sample_alloc(out[num], sz);
+        }
+
+        for (size_t i = 0; size_profile_ && i < got; ++i)
+        {
+            record_size(out[num + i], sz);
+        }
+
+        num += got;
+    }
+
+    return num;
+}
+
+int allocator_t::free_batch( size_t n, void** ptrs )
+{
+    // hand runs of the same class to its allocator at once
+    const static size_t RUN_SIZE = 64;
+    void* run[RUN_SIZE];
+    size_t rnum = 0;
+    int rcls = -1;
+    int ret = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (NULL == ptrs[i])
+        {
+            continue;
+        }
+
+        void* p = unalign(ptrs[i]);
+        int cls = get_block_class(p);
+        if (cls < 0)
+        {
+            span_head_t* h = get_span(p);
+            ret = (NULL == h || free_span(h) < 0)? -1: ret;
+            continue;
+        }
+
+        if (rnum > 0 && (cls != rcls || rnum >= RUN_SIZE))
+        {
+            ret = (free_class_batch(rcls, rnum, run) < 0)? -1: ret;
+            rnum = 0;
+        }
+
+        rcls = cls;
+        on_free(p, cls);
+        run[rnum++] = dataptr2block(p, cls);
+    }
+
+    if (rnum > 0)
+    {
+        ret = (free_class_batch(rcls, rnum, run) < 0)? -1: ret;
+    }
+
+    return ret;
+}
+
+int allocator_t::free_class_batch( int cls, size_t n, void** blocks )
+{
+    int ret = allocators_[cls].free_batch(n, blocks);
+    mark_free_class(cls, true);
+    return ret;
+}
+
+size_t allocator_t::alloc_class_batch( int cls, size_t n, void** out, size_t sz )
+{
+    size_t num = take_class_batch(cls, n, out);
+    // unknown sizes count as the class size, front-ends refill for later allocs
+    W_ALLOC_STAT(if (num > 0) stat_alloc((sz > 0)? sz: get_class_size(cls), num, cls));
+    (void)sz;
+    return num;
+}
+
+size_t allocator_t::take_class_batch( int cls, size_t n, void** out )
+{
+    if (cls < 0 || cls >= (int)anum_)
+    {
+        return 0;
+    }
+
+    fixed_size_allocator_t& fa = allocators_[cls];
+    size_t num = fa.alloc_batch(n, out);
+    if (0 == fa.get_free_num())
+    {
+        mark_free_class(cls, false);
+    }
+
+    if (hsize_ > 0)
+    {
+        for (size_t i = 0; i < num; ++i)
+        {
+            out[i] = block2dataptr(out[i], cls);
+        }
+    }
+
+    return num;
+}
+
+size_t allocator_t::get_stats( class_stats_t* st, size_t n ) const
+{
+    for (size_t i = 0; i < n && i < anum_; ++i)
+    {
+        st[i] = stats_[i];
+        st[i].bsize_ = get_class_size(i);
+        st[i].capacity_ = allocators_[i].get_capacity();
+        allocators_[i].get_stats(st[i].blocks_);
+    }
+
+    return anum_;
+}
+
+void allocator_t::reset_stats()
+{
+    memset(stats_, 0, anum_ * sizeof(class_stats_t));
+    for (size_t i = 0; i < anum_; ++i)
+    {
+        allocators_[i].reset_stats();
+    }
+}
+
+int allocator_t::set_reuse_policy( int policy )
+{
+    for (size_t i = 0; i < anum_; ++i)
+    {
+        int ret = allocators_[i].set_reuse_policy(policy);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+void allocator_t::set_profiler( heap_profiler_t* prof )
+{
+    profiler_ = prof;
+    sample_left_ = prof? prof->next_interval(): INT64_MAX;
+}
+
+void allocator_t::sample_alloc( void* p, size_t sz )
+{
+    if (NULL == profiler_)
+    {
+        sample_left_ = INT64_MAX;
+        return;
+    }
+
+    sample_left_ = profiler_->next_interval();
+    if (NULL == p || profiler_->record_alloc(p, sz) < 0)
+    {
+        return;
+    }
+
+    // large spans are looked up by the profiler on free
+    block_head_t* bh = (hsize_ > 0)? dataptr2bhead(p): NULL;
+    if (bh)
+    {
+        bh->guard_ = MAGIC_SAMPLED;
+    }
+}
+
+void allocator_t::record_size( void* p, size_t sz )
+{
+    size_profile_->record_alloc(p, sz);
+}
+
+void allocator_t::record_free( void* p )
+{
+    size_profile_->record_free(p);
+}
+
+void allocator_t::stat_alloc( size_t sz, size_t num, int cls )
+{
+    int ceil = get_class(sz);
+    if (cls < 0)
+    {
+        // failed, blame the class it should go
+        if (ceil >= 0)
+        {
+            ++stats_[ceil].fail_num_;
+        }
+
+        return;
+    }
+
+    class_stats_t& st = stats_[cls];
+    if (ceil != cls)
+    {
+        st.spill_in_ += num;
+        stats_[ceil].spill_out_ += num;
+    }
+
+    int bucket = (0 == sz)? 0: 64 - __builtin_clzll(sz);
+    st.size_hist_[(bucket < SIZE_HIST_NUM)? bucket: SIZE_HIST_NUM - 1] += num;
+    st.requested_bytes_ += sz * num;
+    st.wasted_bytes_ += (get_class_size(cls) - sz) * num;
+}
+
+void* allocator_t::realloc( size_t sz, void* p )
+{
+    int cls = get_block_class(unalign(p));
+    if (cls < 0)
+    {
+        span_head_t* h = get_span(p);
+        return h? realloc_span(sz, h): NULL;
+    }
+
+    // p may be inside the block if it is from alloc_aligned
+    fixed_size_allocator_t& fa = allocators_[cls];
+    size_t usable = (char*)fa.get_block(p) + fa.get_bsize() - (char*)p;
+    if (usable >= sz)
     {
         return p;
     }
@@ -289,7 +1122,7 @@ void* allocator_t::realloc( size_t sz, void* p )
         return NULL;
     }
 
-    memcpy(n, bh->data_, bh->asize_ - sizeof(block_head_t));
+    memcpy(n, p, usable);
     int ret = free(p);
     if (ret < 0)
     {
@@ -300,3 +1133,211 @@ void* allocator_t::realloc( size_t sz, void* p )
     return n;
 }
 
+
+void allocator_t::set_large_cache( size_t max_bytes )
+{
+    large_cache_max_ = max_bytes;
+    trim_cache(max_bytes);
+}
+
+void* allocator_t::alloc_span( size_t sz, size_t align )
+{
+    size_t psize = page_mask_ + 1;
+    size_t off = (align > LARGE_HEAD_SIZE)? align: LARGE_HEAD_SIZE;
+    if (sz > SIZE_MAX - off - psize)
+    {
+        return NULL;
+    }
+
+    size_t need = (off + sz + page_mask_) & ~page_mask_;
+    span_head_t* h = (off <= psize)? take_cached(need): NULL;
+    if (h)
+    {
+        ++large_stats_.cache_hit_;
+    }
+    else
+    {
+        // payload is off bytes into the mapping, head is in the page before it
+        char* base = (char*)page_map(need, (align > psize)? align: psize, large_page_);
+        if (NULL == base)
+        {
+            return NULL;
+        }
+
+        ++large_stats_.map_num_;
+        h = (span_head_t*)(base + ((off - 1) & ~page_mask_));
+        h->magic_ = SPAN_MAGIC;
+        h->owner_ = this;
+        h->base_ = base;
+        h->size_ = need;
+    }
+
+    h->offset_ = h->base_ + off - (char*)h;
+    link_span(large_live_, h);
+    ++large_stats_.alloc_num_;
+    large_stats_.live_bytes_ += h->size_;
+
+    char* p = (char*)h + h->offset_;
+    // keeps get_block_class from taking it for a block
+    block_head_t* bh = (block_head_t*)(p - offsetof(block_head_t, data_));
+    bh->guard_ = MAGIC_LARGE;
+    bh->cls_ = -1;
+    on_alloc(p, sz);
+    return p;
+}
+
+int allocator_t::free_span( span_head_t* h )
+{
+    void* p = (char*)h + h->offset_;
+    if (profiler_)
+    {
+        profiler_->record_free(p);
+    }
+
+    if (size_profile_)
+    {
+        record_free(p);
+    }
+
+    unlink_span(large_live_, h);
+    ++large_stats_.free_num_;
+    large_stats_.live_bytes_ -= h->size_;
+    // spans aligned over a page are not reused
+    if ((char*)h != h->base_ || h->size_ > large_cache_max_)
+    {
+        page_unmap(h->base_, h->size_);
+        return 0;
+    }
+
+    // stale pointers to a cached span no longer match it
+    h->offset_ = 0;
+    link_span(large_cache_, h);
+    large_stats_.cached_bytes_ += h->size_;
+    trim_cache(large_cache_max_);
+    return 0;
+}
+
+void* allocator_t::realloc_span( size_t sz, span_head_t* h )
+{
+    char* p = (char*)h + h->offset_;
+    size_t head = p - h->base_;
+    if (sz > SIZE_MAX - head - page_mask_)
+    {
+        return NULL;
+    }
+
+    size_t need = (head + sz + page_mask_) & ~page_mask_;
+    if (need <= h->size_)
+    {
+        return p;
+    }
+
+    if ((char*)h == h->base_)
+    {
+        // links point to h, it may move
+        unlink_span(large_live_, h);
+        span_head_t* n = (span_head_t*)page_remap(h, h->size_, need);
+        if (n)
+        {
+            ++large_stats_.remap_num_;
+            large_stats_.live_bytes_ += need - n->size_;
+            n->base_ = (char*)n;
+            n->size_ = need;
+            link_span(large_live_, n);
+            if (profiler_)
+            {
+                profiler_->record_free(p);
+            }
+
+            if (size_profile_)
+            {
+                record_free(p);
+            }
+
+            char* np = (char*)n + n->offset_;
+            on_alloc(np, sz);
+            return np;
+        }
+
+        link_span(large_live_, h);
+    }
+
+    void* n = alloc(sz);
+    if (NULL == n)
+    {
+        return NULL;
+    }
+
+    memcpy(n, p, h->base_ + h->size_ - p);
+    free_span(h);
+    return n;
+}
+
+allocator_t::span_head_t* allocator_t::take_cached( size_t sz )
+{
+    // first fit from most recent, skip spans wasting more than half
+    for (span_head_t* h = large_cache_; h; h = h->next_)
+    {
+        if (h->size_ >= sz && h->size_ / 2 <= sz)
+        {
+            unlink_span(large_cache_, h);
+            large_stats_.cached_bytes_ -= h->size_;
+            return h;
+        }
+    }
+
+    return NULL;
+}
+
+void allocator_t::trim_cache( size_t max_bytes )
+{
+    if (large_stats_.cached_bytes_ <= max_bytes)
+    {
+        return;
+    }
+
+    // oldest at tail
+    span_head_t* h = large_cache_;
+    while (h->next_)
+    {
+        h = h->next_;
+    }
+
+    while (h && large_stats_.cached_bytes_ > max_bytes)
+    {
+        span_head_t* prev = h->prev_;
+        unlink_span(large_cache_, h);
+        large_stats_.cached_bytes_ -= h->size_;
+        page_unmap(h->base_, h->size_);
+        h = prev;
+    }
+}
+
+void allocator_t::link_span( span_head_t*& list, span_head_t* h )
+{
+    h->prev_ = NULL;
+    h->next_ = list;
+    if (list)
+    {
+        list->prev_ = h;
+    }
+
+    list = h;
+}
+
+void allocator_t::unlink_span( span_head_t*& list, span_head_t* h )
+{
+    if (h->prev_)
+    {
+        h->prev_->next_ = h->next_;
+    }
+    else
+    {
+        list = h->next_;
+    }
+
+    if (h->next_)
+    {
+        h->next_->prev_ = h->prev_;
+    }
+}
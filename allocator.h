@@ -3,12 +3,44 @@
 
 #include <cstddef>
 #include <multi_queue.h>
+#include <page_alloc.h>
+#include <heap_profiler.h>
 #include <cstdint>
 
+// define WHEELS_ALLOCATOR_STATS to collect allocator statistics, see get_stats
+#ifdef WHEELS_ALLOCATOR_STATS
+#define W_ALLOC_STAT(expr) do { expr; } while (0)
+#else
+#define W_ALLOC_STAT(expr) do { } while (0)
+#endif
+
+// define WHEELS_ALLOCATOR_DEBUG to catch double free of headless blocks in front-end caches, see allocator_t::mark_cached
+
 namespace wheels
 {
+    class size_profile_t;
+
     class fixed_size_allocator_t
     {
+    public:
+        // counters stay 0 unless WHEELS_ALLOCATOR_STATS is defined
+        struct stats_t
+        {
+            uint64_t alloc_num_;
+            uint64_t fail_num_;     // allocs failed for out of memory
+            uint64_t free_num_;
+            size_t used_num_;
+            size_t peak_used_num_;  // high-water mark of used_num_
+        };
+
+        // which free block alloc takes. never-used blocks are taken in address order after freed ones run out
+        enum reuse_policy_t
+        {
+            reuse_fifo = 0,     // least recently freed first, never-used blocks before freed ones
+            reuse_lifo = 1,     // most recently freed first, still hot in cache
+            reuse_lowest = 2,   // lowest address first, keeps used blocks packed at the front
+        };
+
     private:
         enum qid_t
         {
@@ -16,24 +48,62 @@ namespace wheels
             q_used = 1,
         };
         
+        // block address is derived from its index, so nothing here depends on where data_ is mapped.
+        // constructed when the block is first used
         struct block_t
         {
             uint32_t flag_;
-            void* data_;
         };
 
         enum bflag_t
         {
             block_none = 0,
             block_used = 0x00000001,
+            block_inner = 0x00000002,  // may be freed by pointers inside it
+            block_cached = 0x00000004, // used, but held by a front-end cache(WHEELS_ALLOCATOR_DEBUG only)
         };
 
-        typedef multi_queue_t<block_t> block_mqueue_t;
+        // head of mapped file, followed by queue metadata and blocks
+        struct mmap_head_t
+        {
+            uint64_t magic_;
+            uint64_t bsize_;
+            uint64_t capacity_;
+        };
+
+        // flag is read with the links on every alloc/free, keep them in one element
+        typedef multi_queue_t<block_t, int, mqueue_aos> block_mqueue_t;
+
+        inline void stat_alloc(size_t num, size_t fail)
+        {
+            stats_.alloc_num_ += num;
+            stats_.fail_num_ += fail;
+            if (get_used_num() > stats_.peak_used_num_)
+            {
+                stats_.peak_used_num_ = get_used_num();
+            }
+        }
 
         int bsize_;
         int capacity_;
+        stats_t stats_;
         block_mqueue_t* bqueue_;
-        void* data_;
+        void* data_;    // DATA_ALIGN aligned
+        char* heap_;    // allocated from heap, data_ is aligned inside
+        void* mbase_;   // mapped file or pages, NULL if allocated from heap
+        size_t msize_;
+        bool attached_;
+        int policy_;
+        // reuse_lowest only, bit set if freed block is in q_free. one summary bit per non-zero free_bits_ word
+        uint64_t* free_bits_;
+        uint64_t* free_sum_;
+        const static uint64_t MMAP_MAGIC;
+    public:
+        enum
+        {
+            DATA_ALIGN = 64,
+        };
+    private:
 
         // deny copy-cons
         fixed_size_allocator_t(const fixed_size_allocator_t& c);
@@ -41,6 +111,36 @@ namespace wheels
         {
             return ((char*)addr - (char*)data_) / bsize_;
         }
+
+        inline void* idx_to_address(size_t idx)
+        {
+            return (char*)data_ + idx * bsize_;
+        }
+
+        // return block index of p, -1 if p is not an used block
+        int get_used_idx(void* p);
+        // move a free block to q_used by policy, return its index, -1 if none
+        int alloc_idx();
+        // move used block id to q_free by policy
+        void free_idx(int id);
+        // lowest block with free bit set, -1 if none
+        int find_lowest_free() const;
+        inline void set_free_bit(int id)
+        {
+            free_bits_[id / 64] |= (uint64_t)1 << (id % 64);
+            free_sum_[id / 4096] |= (uint64_t)1 << (id / 64 % 64);
+        }
+
+        inline void clear_free_bit(int id)
+        {
+            uint64_t& w = free_bits_[id / 64];
+            w &= ~((uint64_t)1 << (id % 64));
+            if (0 == w)
+            {
+                free_sum_[id / 4096] &= ~((uint64_t)1 << (id / 64 % 64));
+            }
+        }
+
     public:
         fixed_size_allocator_t();
         ~fixed_size_allocator_t();
@@ -49,12 +149,48 @@ namespace wheels
         void* alloc();
         // dealloc one block, return < 0 if error, coredump if fatal
         int free(void* p);
+        // let used block p be freed by pointers inside it, return < 0 if p is not an used block
+        int mark_inner(void* p);
+        // mark used block p cached, return < 0 if p is not the start of an used block or is cached already
+        int mark_cached(void* p);
+        // cached block p is handed out again
+        void clear_cached(void* p) { bqueue_->get(address_to_idx(p))->flag_ &= (uint32_t)~block_cached; }
+        // alloc up to n blocks into out, return allocated num
+        size_t alloc_batch(size_t n, void** out);
+        // dealloc n blocks, return < 0 if any of them is invalid(valid ones are still freed)
+        int free_batch(size_t n, void** ptrs);
 
+        // blocks are set up on first use, so initialize is O(1) and touches no block memory
         int initialize(size_t bsize, size_t capacity);
+        // map blocks and queue metadata from os with huge pages/numa binding in opt
+        int initialize(size_t bsize, size_t capacity, const page_option_t& opt);
+        /*
+         *	place blocks and queue metadata in file mapped from path, use /dev/shm/xxx for shared memory.
+         *  if path was created with the same bsize & capacity, re-attach to it and keep its used blocks.
+         *  only one process may use the file at a time
+         */
+        int initialize(size_t bsize, size_t capacity, const char* path);
+        // true if initialized by re-attaching an existing file
+        bool is_attached() const { return attached_; }
         size_t get_bsize() const { return bsize_; }
         size_t get_capacity() const { return capacity_; }
         size_t get_used_num() const { return bqueue_->get_num(q_used); }
         size_t get_free_num() const { return capacity_ - get_used_num(); }
+        // start of block containing p, p must be inside data range
+        void* get_block(void* p) { return idx_to_address(address_to_idx(p)); }
+        // address range of blocks
+        void* get_data() const { return data_; }
+        size_t get_data_size() const { return (size_t)bsize_ * capacity_; }
+
+        // free all blocks at once
+        void reset();
+        // reuse_policy_t, may be changed at any time. return < 0 if policy is unknown
+        int set_reuse_policy(int policy);
+        int get_reuse_policy() const { return policy_; }
+
+        void get_stats(stats_t& st) const;
+        // clear counters, peak restarts from current used num
+        void reset_stats();
     };
 
     class allocator_t
@@ -64,6 +200,48 @@ namespace wheels
         {
             size_t capacity_;
             size_t bsize_;
+            size_t align_;  // payload alignment, power of 2 <= MAX_CLASS_ALIGN. 0: natural alignment of bsize_
+        };
+
+        enum
+        {
+            SIZE_HIST_NUM = 32,
+            MAX_CLASS_ALIGN = fixed_size_allocator_t::DATA_ALIGN,
+        };
+
+        // per class statistics, counters stay 0 unless WHEELS_ALLOCATOR_STATS is defined
+        struct class_stats_t
+        {
+            size_t bsize_;              // usable bytes of a block
+            size_t capacity_;
+            fixed_size_allocator_t::stats_t blocks_;
+            uint64_t spill_in_;         // allocs served here because smaller classes were full
+            uint64_t spill_out_;        // allocs routed here but served by a larger class
+            uint64_t fail_num_;         // allocs routed here but all larger classes were full
+            uint64_t requested_bytes_;  // bytes requested by allocs served here
+            uint64_t wasted_bytes_;     // internal fragmentation of allocs served here
+            uint64_t size_hist_[SIZE_HIST_NUM]; // requested sizes, bucket i holds [2^(i-1), 2^i)
+        };
+
+        enum alloc_flag_t
+        {
+            alloc_default = 0,
+            // no block head, owner class is found by address. blocks are exactly bsize_
+            alloc_headless = 0x00000001,
+            // sizes larger than all classes are mapped from os as page spans, freed ones are cached
+            alloc_large = 0x00000002,
+        };
+
+        // large span statistics, see alloc_large
+        struct large_stats_t
+        {
+            uint64_t alloc_num_;
+            uint64_t free_num_;
+            uint64_t map_num_;      // spans mapped from os
+            uint64_t cache_hit_;    // allocs served by a cached span
+            uint64_t remap_num_;    // reallocs grown by mremap
+            size_t live_bytes_;     // mapped bytes of spans in use
+            size_t cached_bytes_;
         };
 
         allocator_t();
@@ -71,41 +249,301 @@ namespace wheels
 
         // alloc one block, return the address
         void* alloc(size_t sz);
+        /*
+         *	alloc sz bytes aligned to align(power of 2), freed by free like others.
+         *  served by a class aligned enough if any, otherwise over-allocates and aligns inside.
+         *  realloc may return a pointer without this alignment
+         */
+        void* alloc_aligned(size_t sz, size_t align);
         // dealloc one block, return < 0 if error, coredump if fatal
         int free(void* p);
         // realloc, return NULL if oom or error(you can still use p), non-NULL if succ, coredump if fatal
         void* realloc(size_t sz, void* p);
+        // alloc up to n blocks of sz bytes into out, return allocated num
+        size_t alloc_batch(size_t sz, size_t n, void** out);
+        // dealloc n blocks, return < 0 if any of them is invalid(valid ones are still freed)
+        int free_batch(size_t n, void** ptrs);
 
-        int initialize(allocator_info_t* allocators);
+        // flags: bitwise or of alloc_flag_t. popt: map pools from os with these options, NULL to use heap
+        int initialize(allocator_info_t* allocators, int flags = alloc_default, const page_option_t* popt = NULL);
+        // true if p is inside one of our pools or is a large span of ours. with alloc_large p must be readable
+        bool is_owner(void* p) const { return get_range_class(p) >= 0 || NULL != get_span(p); }
+
+        // snapshot stats of first n classes into st, return class num
+        size_t get_stats(class_stats_t* st, size_t n) const;
+        void reset_stats();
+        void get_large_stats(large_stats_t& st) const { st = large_stats_; }
+        // keep up to max_bytes of freed large spans for reuse, 0 to unmap them at once. default 32M
+        void set_large_cache(size_t max_bytes);
+        // sample alloc/free into prof, NULL to stop sampling. prof must outlive blocks sampled by it
+        void set_profiler(heap_profiler_t* prof);
+        // fixed_size_allocator_t::reuse_policy_t of every class, return < 0 if policy is unknown
+        int set_reuse_policy(int policy);
+        // record requested sizes of alloc/free into prof, NULL to stop recording
+        void set_size_profile(size_profile_t* prof) { size_profile_ = prof; }
+        // bytes of block head with flags
+        static size_t get_head_size(int flags) { return (flags & alloc_headless)? 0: sizeof(block_head_t); }
+
+        // low-level size class access, used by front-ends like thread_cache_allocator_t
+        size_t get_class_num() const { return anum_; }
+        // usable bytes of blocks in class cls
+        size_t get_class_size(int cls) const { return allocators_[cls].get_bsize() - classes_[cls].hsize_; }
+        // guaranteed alignment of blocks in class cls
+        size_t get_class_align(int cls) const { return classes_[cls].align_; }
+        // return min class which can hold sz bytes, -1 if sz is larger than all classes
+        inline int get_class(size_t sz) const
+        {
+            return (sz <= route_max_)? route_[(sz + route_mask_) >> route_shift_]
+                : get_ceiling_class(sz);
+        }
+
+        // return class of block p, -1 if p is not allocated by us
+        int get_block_class(void* p);
+        // alloc one block from class cls only, return NULL if the class is exhausted
+        void* alloc_class(int cls);
+        // alloc up to n blocks from class cls only, return allocated num. sz: bytes asked per block for stats, 0 if unknown
+        size_t alloc_class_batch(int cls, size_t n, void** out, size_t sz = 0);
+        /*
+         *	block p enters a front-end cache, return its class, < 0 if p is not a plain allocated block.
+         *  the mark lives in the block head, so double free is caught without touching shared pool state.
+         *  headless blocks are only checked to be a block start, unless WHEELS_ALLOCATOR_DEBUG
+         */
+        int mark_cached(void* p);
+        // block p of class cls leaves a front-end cache, to a user or back to its pool
+        inline void clear_cached(void* p, int cls)
+        {
+            if (hsize_ > 0)
+            {
+                ((block_head_t*)((char*)p - offsetof(block_head_t, data_)))->guard_ = MAGIC_GUARD;
+                return;
+            }
+
+#ifdef WHEELS_ALLOCATOR_DEBUG
+            allocators_[cls].clear_cached(p);
+#else
+            (void)cls;
+#endif
+        }
     private:
         struct block_head_t
         {
             int guard_;
-            int asize_; // allocator's bsize
+            int cls_;   // index of allocator
             char data_[0];
         };
 
+        // per class layout, the head(if any) is right before the payload
+        struct class_info_t
+        {
+            size_t hsize_;  // bytes before payload, >= sizeof(block_head_t) unless headless
+            size_t align_;  // alignment of payload
+        };
+
+        // head of a large span, at the start of the page holding the byte before payload
+        struct span_head_t
+        {
+            uint64_t magic_;
+            const allocator_t* owner_;
+            char* base_;        // start of mapping, == this unless aligned over a page
+            size_t size_;       // mapped bytes from base_
+            size_t offset_;     // payload offset from head, <= page size
+            span_head_t* prev_; // links in live or cache list
+            span_head_t* next_;
+        };
+
+        // blocks range of one class, for headless lookup
+        struct range_t
+        {
+            uintptr_t begin_;
+            uintptr_t end_;
+            int cls_;
+
+            bool operator<(const range_t& r) const { return begin_ < r.begin_; }
+        };
+
         // deny copy-cons
         allocator_t(const allocator_t& c);
-        fixed_size_allocator_t* get_allocator(size_t bsize);
-        fixed_size_allocator_t* find_best_allocator(size_t bsize);
-        // return min allocator which >= bsize, -1 if bsize is larger than all allocators
-        int get_ceiling_allocator(size_t bsize) const;
+        // return min class >= get_class(sz) which still has free blocks, -1 if none
+        int find_best_class(size_t sz) const;
+        // return min class whose size >= sz, -1 if sz is larger than all classes
+        int get_ceiling_class(size_t sz) const;
+        // free blocks(not data pointers) of class cls
+        int free_class_batch(int cls, size_t n, void** blocks);
+        // alloc_class_batch without stats, callers record them
+        size_t take_class_batch(int cls, size_t n, void** out);
+        void init_route();
+        // record num allocs of sz bytes served by class cls
+        void stat_alloc(size_t sz, size_t num, int cls);
+        void init_ranges();
+        // sample counter expired, record block p of sz bytes and restart the counter
+        void sample_alloc(void* p, size_t sz);
+        // p of sz bytes is handed out by alloc
+        inline void on_alloc(void* p, size_t sz)
+        {
+            if ((sample_left_ -= sz) < 0)
+            {
+                sample_alloc(p, sz);
+            }
+
+            if (size_profile_)
+            {
+                record_size(p, sz);
+            }
+        }
+
+        // p of class cls is about to be freed
+        inline void on_free(void* p, int cls)
+        {
+            if (NULL == profiler_ && NULL == size_profile_)
+            {
+                return;
+            }
+
+            // headless p may be inside the block, profiles know the block start
+            void* base = (0 == hsize_)? allocators_[cls].get_block(p): p;
+            unsample(base);
+            if (size_profile_)
+            {
+                record_free(base);
+            }
+        }
+
+        void record_size(void* p, size_t sz);
+        void record_free(void* p);
+        // p is about to be freed
+        inline void unsample(void* p)
+        {
+            if (NULL == profiler_)
+            {
+                return;
+            }
+
+            // with block heads sampled ones are marked, otherwise ask the profiler
+            if ((hsize_ > 0)? (MAGIC_SAMPLED == dataptr2bhead(p)->guard_): (profiler_->get_live_num() > 0))
+            {
+                profiler_->record_free(p);
+            }
+        }
+
+        // binary search blocks ranges, -1 if p is not in any
+        int get_range_class(void* p) const;
+
+        // span whose payload is p, NULL if p is not a large span of ours
+        inline span_head_t* get_span(void* p) const
+        {
+            if (0 == page_mask_ || NULL == p)
+            {
+                return NULL;
+            }
+
+            span_head_t* h = (span_head_t*)(((uintptr_t)p - 1) & ~page_mask_);
+            return (SPAN_MAGIC == h->magic_ && this == h->owner_ && (char*)h + h->offset_ == p)? h: NULL;
+        }
+
+        // true if sz goes to a large span
+        inline bool is_large(size_t sz) const { return page_mask_ > 0 && get_class(sz) < 0; }
+        // map or reuse a span for sz bytes aligned to align(power of 2, 0 for default)
+        void* alloc_span(size_t sz, size_t align);
+        int free_span(span_head_t* h);
+        void* realloc_span(size_t sz, span_head_t* h);
+        // take a cached span of at least sz bytes, NULL if none fits
+        span_head_t* take_cached(size_t sz);
+        // unmap cached spans until at most max_bytes are left
+        void trim_cache(size_t max_bytes);
+        static void link_span(span_head_t*& list, span_head_t* h);
+        static void unlink_span(span_head_t*& list, span_head_t* h);
+
+        // fill head of block b in class cls, return the payload
+        inline void* block2dataptr(void* b, int cls)
+        {
+            if (NULL == b || 0 == hsize_)
+            {
+                return b;
+            }
+
+            block_head_t* bh = (block_head_t*)((char*)b + classes_[cls].hsize_ - offsetof(block_head_t, data_));
+            bh->cls_ = cls;
+            bh->guard_ = MAGIC_GUARD;
+            return bh->data_;
+        }
+
+        inline void* dataptr2block(void* p, int cls)
+        {
+            return (0 == hsize_)? p: (char*)p - classes_[cls].hsize_;
+        }
+
+        /*
+         *	pointer from alloc_aligned to payload of its block, others are returned as is.
+         *  headless blocks have no room for this, they are marked inner in their pool instead
+         */
+        inline void* unalign(void* p)
+        {
+            if (NULL == p || 0 == hsize_)
+            {
+                return p;
+            }
+
+            block_head_t* bh = (block_head_t*)((char*)p - offsetof(block_head_t, data_));
+            return (MAGIC_ALIGNED == bh->guard_)? (char*)p - bh->cls_: p;
+        }
+
+        inline void mark_free_class(int cls, bool has_free)
+        {
+            uint64_t bit = (uint64_t)1 << (cls % 64);
+            if (has_free)
+            {
+                free_classes_[cls / 64] |= bit;
+            }
+            else
+            {
+                free_classes_[cls / 64] &= ~bit;
+            }
+        }
 
-        inline bool less_bsize(int idx, size_t bsize) const
+        inline bool less_size(int idx, size_t sz) const
         {
-            return (idx < 0)? true: (allocators_[idx].get_bsize() < bsize);
+            return (idx < 0)? true: (get_class_size(idx) < sz);
         }
 
         inline block_head_t* dataptr2bhead(void* p)
         {
             block_head_t* bh = (block_head_t*)((char*)p - offsetof(block_head_t, data_));
-            return (bh && MAGIC_GUARD == bh->guard_)? bh: NULL;
+            return (bh && (MAGIC_GUARD == bh->guard_ || MAGIC_SAMPLED == bh->guard_))? bh: NULL;
         }
 
         fixed_size_allocator_t* allocators_;
         size_t anum_;
+        size_t hsize_;      // block head size, 0 if headless
+        class_info_t* classes_;
+        range_t* ranges_;   // sorted by address
+        // size -> class table for sizes <= route_max_, one entry per 1 << route_shift_ bytes
+        int16_t* route_;
+        size_t route_max_;
+        size_t route_mask_;
+        int route_shift_;
+        // bit set if class still has free blocks
+        uint64_t* free_classes_;
+        class_stats_t* stats_;
+        heap_profiler_t* profiler_;
+        size_profile_t* size_profile_;
+        // large spans, page_mask_ is 0 unless alloc_large
+        uintptr_t page_mask_;
+        page_option_t large_page_;
+        span_head_t* large_live_;
+        span_head_t* large_cache_;  // most recently freed first
+        size_t large_cache_max_;
+        large_stats_t large_stats_;
+        // bytes left before next sample, the only cost of sampling on alloc fast path
+        int64_t sample_left_;
         const static int MAGIC_GUARD;
+        const static int MAGIC_SAMPLED;    // guard of sampled blocks
+        const static int MAGIC_ALIGNED;    // guard of alloc_aligned pointers inside a block, cls_ is the offset
+        const static int MAGIC_LARGE;      // guard in front of large span payload
+        const static int MAGIC_CACHED;     // guard of blocks held by a front-end cache
+        const static uint64_t SPAN_MAGIC;
+        const static size_t LARGE_HEAD_SIZE;
+        const static size_t LARGE_CACHE_SIZE;
+        const static size_t ROUTE_MAX_SIZE;
     };
 }
 
@@ -0,0 +1,133 @@
+#include <arena_allocator.h>
+
+using namespace wheels;
+
+arena_allocator_t::arena_allocator_t():
+    cur_(NULL), end_(NULL), head_(NULL), tail_(NULL), spare_(NULL), large_(NULL),
+    chunk_size_(0), max_size_(0), used_(0), capacity_(0)
+{
+}
+
+arena_allocator_t::~arena_allocator_t()
+{
+    delete_chunks(head_);
+    delete_chunks(spare_);
+    delete_chunks(large_);
+    head_ = tail_ = spare_ = large_ = NULL;
+    cur_ = end_ = NULL;
+    used_ = 0;
+    capacity_ = 0;
+}
+
+int arena_allocator_t::initialize( size_t chunk_size, size_t max_size )
+{
+    if (chunk_size_ > 0 || chunk_size < ALIGN)
+    {
+        return -1;
+    }
+
+    chunk_size_ = align_size(chunk_size);
+    max_size_ = max_size;
+    return 0;
+}
+
+void arena_allocator_t::reset()
+{
+    // splice used chunks to spare list
+    if (head_)
+    {
+        tail_->next_ = spare_;
+        spare_ = head_;
+        head_ = tail_ = NULL;
+    }
+
+    for (chunk_t* c = large_; c; c = c->next_)
+    {
+        capacity_ -= c->size_;
+    }
+
+    delete_chunks(large_);
+    large_ = NULL;
+    cur_ = end_ = NULL;
+    used_ = 0;
+}
+
+void arena_allocator_t::shrink()
+{
+    for (chunk_t* c = spare_; c; c = c->next_)
+    {
+        capacity_ -= c->size_;
+    }
+
+    delete_chunks(spare_);
+    spare_ = NULL;
+}
+
+void* arena_allocator_t::alloc_slow( size_t sz )
+{
+    if (0 == chunk_size_)
+    {
+        return NULL;
+    }
+
+    if (sz > chunk_size_ / 4)
+    {
+        // dedicated chunk, current one stays
+        chunk_t* c = new_chunk(sz);
+        if (NULL == c)
+        {
+            return NULL;
+        }
+
+        c->next_ = large_;
+        large_ = c;
+        used_ += sz;
+        return chunk_data(c);
+    }
+
+    chunk_t* c = spare_;
+    if (c)
+    {
+        spare_ = c->next_;
+    }
+    else if (NULL == (c = new_chunk(chunk_size_)))
+    {
+        return NULL;
+    }
+
+    c->next_ = head_;
+    head_ = c;
+    if (NULL == tail_)
+    {
+        tail_ = c;
+    }
+
+    cur_ = chunk_data(c) + sz;
+    end_ = chunk_data(c) + c->size_;
+    used_ += sz;
+    return chunk_data(c);
+}
+
+arena_allocator_t::chunk_t* arena_allocator_t::new_chunk( size_t sz )
+{
+    if (max_size_ > 0 && capacity_ + sz > max_size_)
+    {
+        return NULL;
+    }
+
+    chunk_t* c = (chunk_t*)new char[align_size(sizeof(chunk_t)) + sz];
+    c->next_ = NULL;
+    c->size_ = sz;
+    capacity_ += sz;
+    return c;
+}
+
+void arena_allocator_t::delete_chunks( chunk_t* c )
+{
+    while (c)
+    {
+        chunk_t* n = c->next_;
+        delete [](char*)c;
+        c = n;
+    }
+}
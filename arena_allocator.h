@@ -0,0 +1,94 @@
+#ifndef _WHEELS_ARENA_ALLOCATOR_H_
+#define _WHEELS_ARENA_ALLOCATOR_H_
+
+#include <cstddef>
+
+namespace wheels
+{
+    /*
+     *	monotonic arena, bump pointer over chained chunks, not thread-safe
+     *  free is a no-op, reset reclaims everything at once: chunks are kept for the next round,
+     *  requests larger than 1/4 chunk get a dedicated chunk which is released by reset.
+     *  meant for structures living as long as one request, e.g.
+     *  llrbtree_t<int, int, cmp_t, arena_allocator_t> t; t.initialize(&arena); ... t.finalize(); arena.reset();
+     */
+    class arena_allocator_t
+    {
+    public:
+        arena_allocator_t();
+        ~arena_allocator_t();
+
+        // alloc sz bytes aligned to ALIGN, return the address
+        inline void* alloc(size_t sz)
+        {
+            sz = align_size(sz? sz: 1);
+            if ((size_t)(end_ - cur_) < sz)
+            {
+                return alloc_slow(sz);
+            }
+
+            void* p = cur_;
+            cur_ += sz;
+            used_ += sz;
+            return p;
+        }
+
+        // memory is reclaimed by reset
+        int free(void*) { return 0; }
+        // drop all allocations, standard chunks are reused
+        void reset();
+        // release chunks cached by reset
+        void shrink();
+
+        // chunk_size: bytes of one chunk. max_size: limit of all chunks, 0 means unlimited
+        int initialize(size_t chunk_size, size_t max_size = 0);
+        // bytes handed out since last reset
+        size_t get_used_size() const { return used_; }
+        // bytes of all chunks, including cached ones
+        size_t get_capacity() const { return capacity_; }
+
+        enum
+        {
+            ALIGN = 16,
+        };
+
+    private:
+        struct chunk_t
+        {
+            chunk_t* next_;
+            size_t size_;   // bytes of data
+        };
+
+        // deny copy-cons
+        arena_allocator_t(const arena_allocator_t& c);
+
+        static inline size_t align_size(size_t sz)
+        {
+            return (sz + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+        }
+
+        static inline char* chunk_data(chunk_t* c)
+        {
+            return (char*)c + align_size(sizeof(chunk_t));
+        }
+
+        // current chunk is exhausted
+        void* alloc_slow(size_t sz);
+        // new chunk with sz bytes data, NULL if over limit
+        chunk_t* new_chunk(size_t sz);
+        void delete_chunks(chunk_t* c);
+
+        char* cur_;
+        char* end_;
+        chunk_t* head_;     // chunks in use, head_ is current
+        chunk_t* tail_;
+        chunk_t* spare_;    // chunks cached by reset
+        chunk_t* large_;    // dedicated chunks
+        size_t chunk_size_;
+        size_t max_size_;
+        size_t used_;
+        size_t capacity_;
+    };
+}
+
+#endif
@@ -0,0 +1,270 @@
+#include <buddy_allocator.h>
+#include <page_alloc.h>
+#include <cstdlib>
+#include <cstring>
+
+using namespace wheels;
+
+// ceil(log2(v))
+static int ceil_log2(size_t v)
+{
+    return (v <= 1)? 0: 64 - __builtin_clzll(v - 1);
+}
+
+buddy_allocator_t::buddy_allocator_t():
+    data_(NULL), orders_(NULL), min_order_(0), max_order_(0), used_(0), free_mask_(0)
+{
+    memset(free_, 0, sizeof(free_));
+}
+
+buddy_allocator_t::~buddy_allocator_t()
+{
+    if (data_)
+    {
+        page_unmap(data_, get_capacity());
+        data_ = NULL;
+    }
+
+    if (orders_)
+    {
+        delete []orders_;
+        orders_ = NULL;
+    }
+
+    used_ = 0;
+}
+
+int buddy_allocator_t::initialize( size_t min_size, size_t arena_size )
+{
+    if (data_ || min_size < sizeof(free_block_t) || arena_size < min_size)
+    {
+        return -1;
+    }
+
+    min_order_ = ceil_log2(min_size);
+    max_order_ = ceil_log2(arena_size);
+    if (max_order_ > MAX_ORDER || max_order_ - min_order_ >= ORDER_FREE)
+    {
+        return -1;
+    }
+
+    data_ = (char*)page_map(get_capacity(), page_size());
+    if (NULL == data_)
+    {
+        return -1;
+    }
+
+    size_t num = order_span(max_order_);
+    orders_ = new uint8_t[num];
+    memset(orders_, ORDER_NONE, num);
+    push_free(0, max_order_);
+    return 0;
+}
+
+void* buddy_allocator_t::alloc( size_t sz )
+{
+    int order = size_to_order(sz);
+    size_t idx;
+    if (order < 0 || pop_free(order, idx) < 0)
+    {
+        // out of memory
+        return NULL;
+    }
+
+    orders_[idx] = order - min_order_;
+    used_ += (size_t)1 << order;
+    return idx_to_address(idx);
+}
+
+int buddy_allocator_t::free( void* p )
+{
+    if (NULL == p)
+    {
+        return 0;
+    }
+
+    int order = get_used_order(p);
+    if (order < 0)
+    {
+        return -1;
+    }
+
+    used_ -= (size_t)1 << order;
+    size_t idx = address_to_idx(p);
+    // merge with free buddy as long as possible
+    while (order < max_order_)
+    {
+        size_t bidx = idx ^ order_span(order);
+        if (orders_[bidx] != (ORDER_FREE | (order - min_order_)))
+        {
+            break;
+        }
+
+        remove_free(bidx, order);
+        orders_[bidx] = ORDER_NONE;
+        orders_[idx] = ORDER_NONE;
+        idx &= ~order_span(order);
+        ++order;
+    }
+
+    push_free(idx, order);
+    return 0;
+}
+
+void* buddy_allocator_t::realloc( size_t sz, void* p )
+{
+    int order = get_used_order(p);
+    int norder = size_to_order(sz);
+    if (order < 0 || norder < 0)
+    {
+        return NULL;
+    }
+
+    size_t idx = address_to_idx(p);
+    if (norder < order)
+    {
+        // shrink in place, give upper halves back. their buddies are used, no merge
+        for (int k = order - 1; k >= norder; --k)
+        {
+            push_free(idx + order_span(k), k);
+        }
+
+        orders_[idx] = norder - min_order_;
+        used_ -= ((size_t)1 << order) - ((size_t)1 << norder);
+        return p;
+    }
+
+    // grow in place if p is the left buddy at each level and right buddies are free
+    int k = order;
+    for (; k < norder; ++k)
+    {
+        size_t bidx = idx + order_span(k);
+        if (0 != (idx & (order_span(k + 1) - 1))
+            || orders_[bidx] != (ORDER_FREE | (k - min_order_)))
+        {
+            break;
+        }
+    }
+
+    if (k == norder)
+    {
+        for (k = order; k < norder; ++k)
+        {
+            size_t bidx = idx + order_span(k);
+            remove_free(bidx, k);
+            orders_[bidx] = ORDER_NONE;
+        }
+
+        orders_[idx] = norder - min_order_;
+        used_ += ((size_t)1 << norder) - ((size_t)1 << order);
+        return p;
+    }
+
+    void* n = alloc(sz);
+    if (NULL == n)
+    {
+        return NULL;
+    }
+
+    memcpy(n, p, (size_t)1 << order);
+    if (free(p) < 0)
+    {
+        // this should never happen
+        abort();
+    }
+
+    return n;
+}
+
+size_t buddy_allocator_t::get_block_size( void* p ) const
+{
+    int order = get_used_order(p);
+    return (order < 0)? 0: (size_t)1 << order;
+}
+
+int buddy_allocator_t::get_used_order( const void* p ) const
+{
+    if (NULL == data_ || (const char*)p < data_ || (const char*)p >= data_ + get_capacity())
+    {
+        return -1;
+    }
+
+    size_t idx = address_to_idx(p);
+    uint8_t o = orders_[idx];
+    if (idx_to_address(idx) != p || 0 != (o & ORDER_FREE))
+    {
+        return -1;
+    }
+
+    return o + min_order_;
+}
+
+int buddy_allocator_t::size_to_order( size_t sz ) const
+{
+    int order = ceil_log2(sz);
+    if (order < min_order_)
+    {
+        order = min_order_;
+    }
+
+    return (order > max_order_)? -1: order;
+}
+
+void buddy_allocator_t::push_free( size_t idx, int order )
+{
+    free_block_t* b = (free_block_t*)idx_to_address(idx);
+    b->prev_ = NULL;
+    b->next_ = free_[order];
+    if (free_[order])
+    {
+        free_[order]->prev_ = b;
+    }
+
+    free_[order] = b;
+    free_mask_ |= (uint64_t)1 << order;
+    orders_[idx] = ORDER_FREE | (order - min_order_);
+}
+
+void buddy_allocator_t::remove_free( size_t idx, int order )
+{
+    free_block_t* b = (free_block_t*)idx_to_address(idx);
+    if (b->prev_)
+    {
+        b->prev_->next_ = b->next_;
+    }
+    else
+    {
+        free_[order] = b->next_;
+    }
+
+    if (b->next_)
+    {
+        b->next_->prev_ = b->prev_;
+    }
+
+    if (NULL == free_[order])
+    {
+        free_mask_ &= ~((uint64_t)1 << order);
+    }
+}
+
+int buddy_allocator_t::pop_free( int order, size_t& idx )
+{
+    uint64_t mask = free_mask_ & (~(uint64_t)0 << order);
+    if (0 == mask)
+    {
+        return -1;
+    }
+
+    int k = __builtin_ctzll(mask);
+    idx = address_to_idx(free_[k]);
+    remove_free(idx, k);
+    // split down, upper halves go to free lists
+    while (k > order)
+    {
+        --k;
+        push_free(idx + order_span(k), k);
+    }
+
+    return 0;
+}
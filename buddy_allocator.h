@@ -0,0 +1,88 @@
+#ifndef _WHEELS_BUDDY_ALLOCATOR_H_
+#define _WHEELS_BUDDY_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wheels
+{
+    /*
+     *	buddy system allocator for variable size blocks, same api as allocator_t
+     *  blocks are 2^k bytes carved from one arena. free merges a block with its free buddy,
+     *  realloc grows in place by absorbing free buddies on the right.
+     *  block orders are kept in a side table, so blocks have no head
+     */
+    class buddy_allocator_t
+    {
+    public:
+        buddy_allocator_t();
+        ~buddy_allocator_t();
+
+        // alloc one block, return the address
+        void* alloc(size_t sz);
+        // dealloc one block, return < 0 if error
+        int free(void* p);
+        // realloc, return NULL if oom or error(you can still use p), non-NULL if succ, coredump if fatal
+        void* realloc(size_t sz, void* p);
+
+        // min_size & arena_size are rounded up to power of 2, min_size >= 16
+        int initialize(size_t min_size, size_t arena_size);
+        size_t get_capacity() const { return (size_t)1 << max_order_; }
+        // bytes of allocated blocks
+        size_t get_used_size() const { return used_; }
+        // usable bytes of block p, 0 if p is invalid
+        size_t get_block_size(void* p) const;
+
+    private:
+        struct free_block_t
+        {
+            free_block_t* prev_;
+            free_block_t* next_;
+        };
+
+        enum
+        {
+            MAX_ORDER = 48,
+            ORDER_FREE = 0x80,  // set in orders_ for free block heads
+            ORDER_NONE = 0xFF,  // not a block head
+        };
+
+        // deny copy-cons
+        buddy_allocator_t(const buddy_allocator_t& c);
+
+        inline size_t address_to_idx(const void* p) const
+        {
+            return ((const char*)p - data_) >> min_order_;
+        }
+
+        inline char* idx_to_address(size_t idx) const
+        {
+            return data_ + (idx << min_order_);
+        }
+
+        // min blocks in a block of order
+        inline size_t order_span(int order) const
+        {
+            return (size_t)1 << (order - min_order_);
+        }
+
+        // order of allocated block p, -1 if p is invalid
+        int get_used_order(const void* p) const;
+        // smallest order can hold sz, -1 if too large
+        int size_to_order(size_t sz) const;
+        void push_free(size_t idx, int order);
+        void remove_free(size_t idx, int order);
+        // pop a free block of order into idx, split larger one if needed. return < 0 if oom
+        int pop_free(int order, size_t& idx);
+
+        char* data_;
+        uint8_t* orders_;       // per min block
+        int min_order_;
+        int max_order_;
+        size_t used_;
+        uint64_t free_mask_;    // bit k set if free_[k] not empty
+        free_block_t* free_[MAX_ORDER + 1];
+    };
+}
+
+#endif
@@ -0,0 +1,127 @@
+#include <concurrent_allocator.h>
+#include <cstdlib>
+
+using namespace wheels;
+
+concurrent_fixed_size_allocator_t::concurrent_fixed_size_allocator_t():
+    bsize_(0), capacity_(0), next_(NULL), flag_(NULL), data_(NULL),
+    head_(INVALID_IDX), used_(0)
+{
+}
+
+concurrent_fixed_size_allocator_t::~concurrent_fixed_size_allocator_t()
+{
+    if (next_)
+    {
+        delete []next_;
+        next_ = NULL;
+    }
+
+    if (flag_)
+    {
+        delete []flag_;
+        flag_ = NULL;
+    }
+
+    if (data_)
+    {
+        delete [](char*)data_;
+        data_ = NULL;
+    }
+
+    bsize_ = 0;
+    capacity_ = 0;
+}
+
+int concurrent_fixed_size_allocator_t::initialize( size_t bsize, size_t capacity )
+{
+    if (data_ || bsize <= 0 || capacity <= 0 || capacity >= INVALID_IDX)
+    {
+        return -1;
+    }
+
+    next_ = new uint32_t[capacity];
+    flag_ = new uint32_t[capacity];
+    data_ = new char[bsize*capacity];
+    if (NULL == next_ || NULL == flag_ || NULL == data_)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        next_[i] = i + 1;
+        flag_[i] = block_none;
+    }
+
+    next_[capacity - 1] = INVALID_IDX;
+    bsize_ = bsize;
+    capacity_ = capacity;
+    used_ = 0;
+    __atomic_store_n(&head_, 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void* concurrent_fixed_size_allocator_t::alloc()
+{
+    uint64_t old = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+    uint32_t idx;
+    do
+    {
+        idx = head_idx(old);
+        if (INVALID_IDX == idx)
+        {
+            // out of memory
+            return NULL;
+        }
+
+        // next_[idx] may be stale if idx is popped concurrently, tag will fail the CAS then
+        uint32_t next = __atomic_load_n(&next_[idx], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&head_, &old, make_head(old, next),
+            true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+    } while (true);
+
+    __atomic_store_n(&flag_[idx], block_used, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&used_, 1, __ATOMIC_RELAXED);
+    return (char*)data_ + idx * bsize_;
+}
+
+int concurrent_fixed_size_allocator_t::free( void* p )
+{
+    if (NULL == p)
+    {
+        return 0;
+    }
+
+    if ((char*)p < (char*)data_)
+    {
+        return -1;
+    }
+
+    size_t id = address_to_idx(p);
+    if (id >= capacity_ || (char*)data_ + id * bsize_ != p)
+    {
+        return -1;
+    }
+
+    // only one of concurrent frees on the same block wins
+    uint32_t used = block_used;
+    if (!__atomic_compare_exchange_n(&flag_[id], &used, (uint32_t)block_none,
+        false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        return -1;
+    }
+
+    uint64_t old = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+    do
+    {
+        __atomic_store_n(&next_[id], head_idx(old), __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&head_, &old, make_head(old, id),
+        true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    __atomic_sub_fetch(&used_, 1, __ATOMIC_RELAXED);
+    return 0;
+}
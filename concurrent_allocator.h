@@ -0,0 +1,77 @@
+#ifndef _WHEELS_CONCURRENT_ALLOCATOR_H_
+#define _WHEELS_CONCURRENT_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wheels
+{
+    /*
+     *	thread-safe fixed_size_allocator_t, same api
+     *  free blocks form a lock-free stack of indices. head is tagged with a version
+     *  counter which changes on every push/pop, so a stale CAS never succeeds (no ABA)
+     */
+    class concurrent_fixed_size_allocator_t
+    {
+    private:
+        enum bflag_t
+        {
+            block_none = 0,
+            block_used = 0x00000001,
+        };
+
+        enum
+        {
+            CACHELINE_SIZE = 64,
+            INVALID_IDX = 0xFFFFFFFF,
+        };
+
+        // high 32 bits: tag, low 32 bits: block index
+        static inline uint64_t make_head(uint64_t old, uint32_t idx)
+        {
+            return (((old >> 32) + 1) << 32) | idx;
+        }
+
+        static inline uint32_t head_idx(uint64_t head)
+        {
+            return (uint32_t)head;
+        }
+
+        // deny copy-cons
+        concurrent_fixed_size_allocator_t(const concurrent_fixed_size_allocator_t& c);
+        inline size_t address_to_idx(void* addr)
+        {
+            return ((char*)addr - (char*)data_) / bsize_;
+        }
+
+        // read-only after initialize
+        size_t bsize_;
+        size_t capacity_;
+        uint32_t* next_;
+        uint32_t* flag_;
+        void* data_;
+        // contended words live in their own cache lines
+        char pad0_[CACHELINE_SIZE];
+        uint64_t head_;
+        char pad1_[CACHELINE_SIZE - sizeof(uint64_t)];
+        size_t used_;
+        char pad2_[CACHELINE_SIZE - sizeof(size_t)];
+    public:
+        concurrent_fixed_size_allocator_t();
+        ~concurrent_fixed_size_allocator_t();
+
+        // alloc one block, return the address
+        void* alloc();
+        // dealloc one block, return < 0 if error(including double free)
+        int free(void* p);
+
+        // not thread-safe, call before sharing
+        int initialize(size_t bsize, size_t capacity);
+        size_t get_bsize() const { return bsize_; }
+        size_t get_capacity() const { return capacity_; }
+        size_t get_used_num() const { return __atomic_load_n(&used_, __ATOMIC_RELAXED); }
+        size_t get_free_num() const { return capacity_ - get_used_num(); }
+    };
+}
+
+#endif
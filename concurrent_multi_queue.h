@@ -0,0 +1,377 @@
+#ifndef _WHEELS_CONCURRENT_MULTI_QUEUE_H_
+#define _WHEELS_CONCURRENT_MULTI_QUEUE_H_
+
+#include <multi_queue.h>
+#include <cstdint>
+#include <sched.h>
+
+namespace wheels
+{
+    /*
+     *	thread-safe multi_queue_t, every queue has its own spin lock, so operations on
+     *  different queues run in parallel. cross-queue moves lock both queues in id order(no deadlock).
+     *  node operations look up the node's queue without lock, then lock it and check again,
+     *  retrying if the node was moved meanwhile. queue(0) and never-used nodes share lock 0.
+     *  T of a node is not protected, it belongs to whoever moved the node where it is
+     */
+    template<typename T, typename I = int, int L = mqueue_soa>
+    class concurrent_multi_queue_t
+    {
+    public:
+        typedef multi_queue_t<T, I, L> queue_type;
+
+        concurrent_multi_queue_t(int node_capacity, int queue_capacity):
+            queue_(node_capacity, queue_capacity), queue_capacity_(queue_capacity)
+        {
+            // one lock per cache line
+            lock_mem_ = new char[sizeof(lock_t) * (queue_capacity + 1) + CACHELINE_SIZE];
+            locks_ = (lock_t*)(((uintptr_t)lock_mem_ + CACHELINE_SIZE - 1) & ~(uintptr_t)(CACHELINE_SIZE - 1));
+            for (int i = 0; i <= queue_capacity; ++i)
+            {
+                locks_[i].locked_ = 0;
+            }
+        }
+
+        ~concurrent_multi_queue_t()
+        {
+            if (lock_mem_)
+            {
+                delete []lock_mem_;
+                lock_mem_ = NULL;
+                locks_ = NULL;
+            }
+        }
+
+        // move node from queue[src].head to queue[dst].tail, its index is stored in idx if not NULL
+        int move(int src, int dst, int* idx = NULL)
+        {
+            if (!is_valid_queue(src) || !is_valid_queue(dst))
+            {
+                return -1;
+            }
+
+            lock_pair(src, dst);
+            int ret = queue_.move(src, dst);
+            if (0 == ret && idx)
+            {
+                *idx = queue_.get_tail(dst);
+            }
+
+            unlock_pair(src, dst);
+            return ret;
+        }
+
+        // move node from queue[qid].head to queue[0].tail
+        int remove(int qid, int* idx = NULL)
+        {
+            return move(qid, 0, idx);
+        }
+
+        // move node from queue[0].head to queue[qid].tail
+        int append(int qid, int* idx = NULL)
+        {
+            return move(0, qid, idx);
+        }
+
+        // move up to n nodes from queue[src].head to queue[dst].tail in one splice, return moved num
+        int move_n(int src, int dst, int n)
+        {
+            if (!is_valid_queue(src) || !is_valid_queue(dst))
+            {
+                return -1;
+            }
+
+            lock_pair(src, dst);
+            int ret = queue_.move_n(src, dst, n);
+            unlock_pair(src, dst);
+            return ret;
+        }
+
+        // move all nodes of queue[src] to queue[dst].tail(or head if to_head), return moved num
+        int splice(int src, int dst, bool to_head = false)
+        {
+            if (!is_valid_queue(src) || !is_valid_queue(dst))
+            {
+                return -1;
+            }
+
+            lock_pair(src, dst);
+            int ret = queue_.splice(src, dst, to_head);
+            unlock_pair(src, dst);
+            return ret;
+        }
+
+        // move run [first, last] of one queue to queue[dst].tail(or head if to_head), return moved num
+        int splice_range(int first, int last, int dst, bool to_head = false)
+        {
+            if (!is_valid_queue(dst))
+            {
+                return -1;
+            }
+
+            int src = lock_node(first, dst);
+            if (src < 0)
+            {
+                return -1;
+            }
+
+            // last must be in the locked queue too
+            int ret = (queue_.get_queue_id(last) == src)? queue_.splice_range(first, last, dst, to_head): -1;
+            unlock_pair(src, dst);
+            return ret;
+        }
+
+        // like splice_range, but caller tells the run has n nodes so it is not walked to count
+        int splice_range_n(int first, int last, int n, int dst, bool to_head = false)
+        {
+            if (!is_valid_queue(dst))
+            {
+                return -1;
+            }
+
+            int src = lock_node(first, dst);
+            if (src < 0)
+            {
+                return -1;
+            }
+
+            // last must be in the locked queue too
+            int ret = (queue_.get_queue_id(last) == src)? queue_.splice_range_n(first, last, n, dst, to_head): -1;
+            unlock_pair(src, dst);
+            return ret;
+        }
+
+        // move node idx from its queue to queue[dst].tail
+        int move_node(int idx, int dst)
+        {
+            if (!is_valid_queue(dst))
+            {
+                return -1;
+            }
+
+            int src = lock_node(idx, dst);
+            if (src < 0)
+            {
+                return -1;
+            }
+
+            int ret = queue_.move_node(idx, dst);
+            unlock_pair(src, dst);
+            return ret;
+        }
+
+        // move node idx from its queue to queue[dst].head
+        int move_node_head(int idx, int dst)
+        {
+            if (!is_valid_queue(dst))
+            {
+                return -1;
+            }
+
+            int src = lock_node(idx, dst);
+            if (src < 0)
+            {
+                return -1;
+            }
+
+            int ret = queue_.move_node_head(idx, dst);
+            unlock_pair(src, dst);
+            return ret;
+        }
+
+        /*
+         *	move node idx to queue[dst].tail only if it is still in queue[src], return < 0 if not.
+         *  a state transition which must not race with another one on the same node
+         */
+        int move_node_if(int idx, int src, int dst)
+        {
+            if (!is_valid_queue(src) || !is_valid_queue(dst))
+            {
+                return -1;
+            }
+
+            lock_pair(src, dst);
+            int ret = (queue_.get_queue_id(idx) == src)? queue_.move_node(idx, dst): -1;
+            unlock_pair(src, dst);
+            return ret;
+        }
+
+        // swap two elements in the same queue
+        int swap(int left, int right)
+        {
+            int qid = lock_node(left, -1);
+            if (qid < 0)
+            {
+                return -1;
+            }
+
+            // the other node must be in the locked queue too
+            int ret = (queue_.get_queue_id(right) == qid)? queue_.swap(left, right): -1;
+            unlock(qid);
+            return ret;
+        }
+
+        // move src after dst, src & dst MUST in the same queue
+        int move_after(int src, int dst)
+        {
+            int qid = lock_node(src, -1);
+            if (qid < 0)
+            {
+                return -1;
+            }
+
+            // the other node must be in the locked queue too
+            int ret = (queue_.get_queue_id(dst) == qid)? queue_.move_after(src, dst): -1;
+            unlock(qid);
+            return ret;
+        }
+
+        // move src before dst, src & dst MUST in the same queue
+        int move_before(int src, int dst)
+        {
+            int qid = lock_node(src, -1);
+            if (qid < 0)
+            {
+                return -1;
+            }
+
+            // the other node must be in the locked queue too
+            int ret = (queue_.get_queue_id(dst) == qid)? queue_.move_before(src, dst): -1;
+            unlock(qid);
+            return ret;
+        }
+
+        // lock-free, storage of a node never moves and is published before the node(mqueue_grow too)
+        T* get(int idx) { return queue_.get(idx); }
+        const T* get(int idx) const { return queue_.get(idx); }
+        int get_idx(const T* data) const { return queue_.get_idx(data); }
+        int get_capacity() const { return queue_.get_capacity(); }
+        // queue of node idx, may change right after return
+        int get_queue_id(int idx) const { return queue_.get_queue_id(idx); }
+
+        int get_num(int qid)
+        {
+            if (!is_valid_queue(qid))
+            {
+                return -1;
+            }
+
+            lock(qid);
+            int num = queue_.get_num(qid);
+            unlock(qid);
+            return num;
+        }
+
+        // all nodes back to never-used, no other operation may run at the same time
+        void reset()
+        {
+            queue_.reset();
+        }
+
+        /*
+         *	lock queue qid for walking it through get_queue(), e.g.
+         *  for (int i = q.get_queue().get_head(qid); i >= 0; i = q.get_queue().get_next_id(i))
+         *  nodes must not be moved through get_queue()
+         */
+        void lock(int qid)
+        {
+            lock_t& l = locks_[qid];
+            int spin = 0;
+            while (__atomic_exchange_n(&l.locked_, 1, __ATOMIC_ACQUIRE))
+            {
+                // wait on a plain load, keeps the cache line shared
+                while (__atomic_load_n(&l.locked_, __ATOMIC_RELAXED))
+                {
+                    if (++spin >= MAX_SPIN)
+                    {
+                        spin = 0;
+                        sched_yield();
+                    }
+                }
+            }
+        }
+
+        void unlock(int qid)
+        {
+            __atomic_store_n(&locks_[qid].locked_, 0, __ATOMIC_RELEASE);
+        }
+
+        const queue_type& get_queue() const { return queue_; }
+
+    private:
+        enum
+        {
+            CACHELINE_SIZE = 64,
+            MAX_SPIN = 1024,    // yield after spinning this many times
+        };
+
+        struct lock_t
+        {
+            int locked_;
+            char pad_[CACHELINE_SIZE - sizeof(int)];
+        };
+
+        // deny copy-cons
+        concurrent_multi_queue_t(const concurrent_multi_queue_t& c);
+
+        inline bool is_valid_queue(int i) const
+        {
+            return i >= 0 && i <= queue_capacity_;
+        }
+
+        // lower id first
+        void lock_pair(int a, int b)
+        {
+            if (a == b)
+            {
+                lock(a);
+            }
+            else
+            {
+                lock((a < b)? a: b);
+                lock((a < b)? b: a);
+            }
+        }
+
+        void unlock_pair(int a, int b)
+        {
+            unlock(a);
+            if (a != b)
+            {
+                unlock(b);
+            }
+        }
+
+        /*
+         *	lock queue of node idx(and dst if >= 0), return the queue, -1 if idx is invalid.
+         *  the node may move before its queue is locked, so check again and retry
+         */
+        int lock_node(int idx, int dst)
+        {
+            while (true)
+            {
+                // a published node always has its queue id, check anyway before it picks a lock
+                int qid = queue_.get_queue_id(idx);
+                if (!is_valid_queue(qid))
+                {
+                    return -1;
+                }
+
+                lock_pair(qid, (dst < 0)? qid: dst);
+                if (queue_.get_queue_id(idx) == qid)
+                {
+                    return qid;
+                }
+
+                unlock_pair(qid, (dst < 0)? qid: dst);
+            }
+        }
+
+        queue_type queue_;
+        int queue_capacity_;
+        char* lock_mem_;
+        lock_t* locks_;     // CACHELINE_SIZE aligned, one per queue
+    };
+}
+
+#endif
@@ -0,0 +1,267 @@
+#include <heap_profiler.h>
+#include <execinfo.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstring>
+
+using namespace wheels;
+
+// min power of 2 >= v
+static size_t ceil_pow2(size_t v)
+{
+    size_t n = 1;
+    while (n < v)
+    {
+        n <<= 1;
+    }
+
+    return n;
+}
+
+heap_profiler_t::heap_profiler_t():
+    sample_bytes_(0), rand_(0), stacks_(NULL), order_(NULL), stack_cap_(0), stack_num_(0),
+    lives_(NULL), live_cap_(0), live_num_(0), dropped_num_(0)
+{
+}
+
+heap_profiler_t::~heap_profiler_t()
+{
+    if (stacks_)
+    {
+        delete []stacks_;
+        stacks_ = NULL;
+    }
+
+    if (order_)
+    {
+        delete []order_;
+        order_ = NULL;
+    }
+
+    if (lives_)
+    {
+        delete []lives_;
+        lives_ = NULL;
+    }
+
+    stack_num_ = 0;
+    live_num_ = 0;
+}
+
+int heap_profiler_t::initialize( size_t sample_bytes, size_t max_stacks, size_t max_live )
+{
+    if (stacks_ || 0 == sample_bytes || 0 == max_stacks || 0 == max_live)
+    {
+        return -1;
+    }
+
+    sample_bytes_ = sample_bytes;
+    rand_ = (uint64_t)(uintptr_t)this ^ ((uint64_t)getpid() << 32) ^ 0x9E3779B97F4A7C15ULL;
+    // keep tables at most half full
+    stack_cap_ = ceil_pow2(max_stacks * 2);
+    stacks_ = new stack_t[stack_cap_];
+    order_ = new int[stack_cap_ / 2];
+    live_cap_ = ceil_pow2(max_live * 2);
+    lives_ = new live_t[live_cap_];
+    if (NULL == stacks_ || NULL == order_ || NULL == lives_)
+    {
+        return -1;
+    }
+
+    reset();
+    return 0;
+}
+
+void heap_profiler_t::reset()
+{
+    memset(stacks_, 0, stack_cap_ * sizeof(stack_t));
+    memset(lives_, 0, live_cap_ * sizeof(live_t));
+    stack_num_ = 0;
+    live_num_ = 0;
+    dropped_num_ = 0;
+}
+
+int64_t heap_profiler_t::next_interval()
+{
+    // xorshift64, then exponential distribution with mean sample_bytes_
+    rand_ ^= rand_ << 13;
+    rand_ ^= rand_ >> 7;
+    rand_ ^= rand_ << 17;
+    double u = ((rand_ >> 11) + 1) * (1.0 / 9007199254740992.0);
+    double v = -log(u) * sample_bytes_;
+    return (v < (double)INT32_MAX * sample_bytes_)? (int64_t)v: (int64_t)INT32_MAX * sample_bytes_;
+}
+
+int heap_profiler_t::record_alloc( void* p, size_t sz )
+{
+    void* frames[MAX_DEPTH + 1];
+    // skip this frame
+    int depth = backtrace(frames, MAX_DEPTH + 1) - 1;
+    if (NULL == p || depth <= 0 || live_num_ >= live_cap_ / 2)
+    {
+        ++dropped_num_;
+        return -1;
+    }
+
+    int idx = find_stack(frames + 1, depth);
+    if (idx < 0)
+    {
+        ++dropped_num_;
+        return -1;
+    }
+
+    live_t& l = lives_[find_live(p)];
+    if (l.ptr_)
+    {
+        // not freed through us, drop the stale record
+        stack_t& old = stacks_[l.stack_];
+        --old.live_num_;
+        old.live_bytes_ -= l.size_;
+        --live_num_;
+    }
+
+    l.ptr_ = p;
+    l.stack_ = idx;
+    l.size_ = sz;
+    ++live_num_;
+
+    stack_t& s = stacks_[idx];
+    ++s.alloc_num_;
+    s.alloc_bytes_ += sz;
+    ++s.live_num_;
+    s.live_bytes_ += sz;
+    return 0;
+}
+
+int heap_profiler_t::record_free( void* p )
+{
+    if (0 == live_num_)
+    {
+        return -1;
+    }
+
+    size_t i = find_live(p);
+    if (NULL == lives_[i].ptr_)
+    {
+        return -1;
+    }
+
+    stack_t& s = stacks_[lives_[i].stack_];
+    --s.live_num_;
+    s.live_bytes_ -= lives_[i].size_;
+    --live_num_;
+
+    // backward shift deletion, keeps probe chains intact without tombstones
+    size_t mask = live_cap_ - 1;
+    size_t j = i;
+    while (true)
+    {
+        j = (j + 1) & mask;
+        if (NULL == lives_[j].ptr_)
+        {
+            break;
+        }
+
+        size_t home = hash_ptr(lives_[j].ptr_) & mask;
+        // move j to hole i if its home is not in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            lives_[i] = lives_[j];
+            i = j;
+        }
+    }
+
+    lives_[i].ptr_ = NULL;
+    return 0;
+}
+
+int heap_profiler_t::find_stack( void** frames, int depth )
+{
+    uint64_t h = hash_frames(frames, depth);
+    size_t mask = stack_cap_ - 1;
+    for (size_t i = h & mask; ; i = (i + 1) & mask)
+    {
+        stack_t& s = stacks_[i];
+        if (0 == s.depth_)
+        {
+            if (stack_num_ >= stack_cap_ / 2)
+            {
+                return -1;
+            }
+
+            s.hash_ = h;
+            s.depth_ = depth;
+            memcpy(s.frames_, frames, depth * sizeof(void*));
+            order_[stack_num_++] = i;
+            return i;
+        }
+
+        if (s.hash_ == h && s.depth_ == depth && 0 == memcmp(s.frames_, frames, depth * sizeof(void*)))
+        {
+            return i;
+        }
+    }
+}
+
+size_t heap_profiler_t::find_live( void* p ) const
+{
+    size_t mask = live_cap_ - 1;
+    size_t i = hash_ptr(p) & mask;
+    while (lives_[i].ptr_ && lives_[i].ptr_ != p)
+    {
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+uint64_t heap_profiler_t::hash_frames( void** frames, int depth )
+{
+    // fnv-1a over return addresses
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < depth; ++i)
+    {
+        h ^= (uint64_t)(uintptr_t)frames[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+uint64_t heap_profiler_t::hash_ptr( void* p )
+{
+    uint64_t h = (uint64_t)(uintptr_t)p;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+void heap_profiler_t::dump( FILE* fp ) const
+{
+    fprintf(fp, "heap profile: %zu stacks, 1 sample per %zu bytes, %zu live samples, %llu dropped\n",
+        stack_num_, sample_bytes_, live_num_, (unsigned long long)dropped_num_);
+    for (size_t i = 0; i < stack_num_; ++i)
+    {
+        const stack_t& s = get_stack(i);
+        fprintf(fp, "%llu: %llu [%llu: %llu] @",
+            (unsigned long long)s.live_num_, (unsigned long long)s.live_bytes_,
+            (unsigned long long)s.alloc_num_, (unsigned long long)s.alloc_bytes_);
+        for (int k = 0; k < s.depth_; ++k)
+        {
+            fprintf(fp, " %p", s.frames_[k]);
+        }
+
+        fprintf(fp, "\n");
+    }
+
+    // symbolize, backtrace_symbols_fd writes to fd directly
+    fflush(fp);
+    for (size_t i = 0; i < stack_num_; ++i)
+    {
+        const stack_t& s = get_stack(i);
+        fprintf(fp, "stack %zu:\n", i);
+        fflush(fp);
+        backtrace_symbols_fd((void* const*)s.frames_, s.depth_, fileno(fp));
+    }
+}
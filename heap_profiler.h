@@ -0,0 +1,91 @@
+#ifndef _WHEELS_HEAP_PROFILER_H_
+#define _WHEELS_HEAP_PROFILER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+namespace wheels
+{
+    /*
+     *	sampling heap profiler, not thread-safe, attach with allocator_t::set_profiler
+     *  about one alloc per sample_bytes allocated bytes is sampled (exponential intervals, so
+     *  periodic patterns are not missed). a sample captures the call stack, and counts into
+     *  the table entry of that stack until the block is freed. dump prints the table
+     */
+    class heap_profiler_t
+    {
+    public:
+        enum
+        {
+            MAX_DEPTH = 32,
+        };
+
+        // counters of one call stack, only sampled allocs are counted
+        struct stack_t
+        {
+            uint64_t hash_;
+            int depth_;
+            void* frames_[MAX_DEPTH];
+            uint64_t alloc_num_;
+            uint64_t alloc_bytes_;
+            uint64_t live_num_;     // sampled blocks not freed yet
+            uint64_t live_bytes_;
+        };
+
+        heap_profiler_t();
+        ~heap_profiler_t();
+
+        // max_stacks: distinct stacks kept, max_live: sampled blocks tracked at the same time
+        int initialize(size_t sample_bytes, size_t max_stacks = 1024, size_t max_live = 4096);
+        // bytes to allocate before next sample
+        int64_t next_interval();
+        // record sampled block p of sz bytes with current stack, return < 0 if table is full
+        int record_alloc(void* p, size_t sz);
+        // forget sampled block p, return < 0 if p is not tracked
+        int record_free(void* p);
+        // tracked blocks not freed yet
+        size_t get_live_num() const { return live_num_; }
+        // samples dropped for full tables
+        uint64_t get_dropped_num() const { return dropped_num_; }
+        size_t get_sample_bytes() const { return sample_bytes_; }
+
+        // stacks in table are get_stack(0..get_stack_num()-1)
+        size_t get_stack_num() const { return stack_num_; }
+        const stack_t& get_stack(size_t i) const { return stacks_[order_[i]]; }
+        // print one line per stack: live_num live_bytes alloc_num alloc_bytes @ frames, symbolized below
+        void dump(FILE* fp) const;
+        // clear all counters and tracked blocks
+        void reset();
+
+    private:
+        struct live_t
+        {
+            void* ptr_;     // NULL if slot is empty
+            int stack_;
+            size_t size_;
+        };
+
+        // deny copy-cons
+        heap_profiler_t(const heap_profiler_t& c);
+        // return stack index of frames, -1 if table is full
+        int find_stack(void** frames, int depth);
+        // slot of p in lives_, or the empty slot it should go
+        size_t find_live(void* p) const;
+        static uint64_t hash_frames(void** frames, int depth);
+        static uint64_t hash_ptr(void* p);
+
+        size_t sample_bytes_;
+        uint64_t rand_;
+        stack_t* stacks_;       // open addressing by hash_
+        int* order_;            // used slots of stacks_, in insertion order
+        size_t stack_cap_;      // power of 2
+        size_t stack_num_;
+        live_t* lives_;         // open addressing by pointer, linear probing
+        size_t live_cap_;       // power of 2
+        size_t live_num_;
+        uint64_t dropped_num_;
+    };
+}
+
+#endif
@@ -2,24 +2,44 @@
 #define _MULTI_QUEUE_
 
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 
 namespace wheels
 {
-    // forward declaration
-    template<class T>
+    enum mqueue_layout_t
+    {
+        mqueue_soa = 0,     // links and payloads in separate arrays, walking links stays in the dense link array
+        mqueue_aos = 1,     // links next to their payload, one cache line holds both when T is small
+        /*
+         *	like mqueue_aos, but elements are kept in segments allocated as nodes are first used,
+         *  so node_capacity is only a limit. segments never move, indices and T* stay valid.
+         *  heap only, sizeof(T) must be < 4K
+         */
+        mqueue_grow = 2,
+    };
+
+    /*
+     *	forward declaration. I: signed index type(int16_t/int32_t), capacities must fit in it.
+     *  L: mqueue_layout_t
+     */
+    template<typename T, typename I = int, int L = mqueue_soa>
     class multi_queue_t;
 
-    // queue iterator
-    template<class T>
+    // queue iterator, Q is the multi_queue_t
+    template<class Q>
     class _mqueue_const_iterator_t
     {
     public:
+        typedef typename Q::value_type T;
         typedef T* pointer;
         typedef const T* const_pointer;
         typedef T& reference;
         typedef const T& const_reference;
-        typedef multi_queue_t<T>* queue_pointer;
-        typedef const multi_queue_t<T>* const_queue_pointer;
+        typedef Q* queue_pointer;
+        typedef const Q* const_queue_pointer;
 
         _mqueue_const_iterator_t(int cidx, const_queue_pointer c):
             current_(cidx), container_(c)
@@ -71,17 +91,18 @@ namespace wheels
         const_queue_pointer container_;
     };
 
-    template<class T>
-    class _mqueue_iterator_t: public _mqueue_const_iterator_t<T>
+    template<class Q>
+    class _mqueue_iterator_t: public _mqueue_const_iterator_t<Q>
     {
     public:
-        typedef _mqueue_const_iterator_t<T> base_t;
+        typedef _mqueue_const_iterator_t<Q> base_t;
+        typedef typename Q::value_type T;
         typedef T* pointer;
         typedef const T* const_pointer;
         typedef T& reference;
         typedef const T& const_reference;
-        typedef multi_queue_t<T>* queue_pointer;
-        typedef const multi_queue_t<T>* const_queue_pointer;
+        typedef Q* queue_pointer;
+        typedef const Q* const_queue_pointer;
 
         _mqueue_iterator_t(int cidx, const_queue_pointer c):
             base_t(cidx, c)
@@ -105,58 +126,170 @@ namespace wheels
     };
 
     // multi queue
-    template<typename T>
+    template<typename T, typename I, int L>
     class multi_queue_t
     {
     public:
+        typedef T value_type;
+        typedef I index_type;
+
         struct qnode_t
         {
-            int qid_;   // queue id
-            int prev_;
-            int next_;
+            I qid_;     // queue id
+            I prev_;
+            I next_;
         };
 
         struct queue_t
         {
-            int head_;
-            int tail_;
-            int num_;
+            I head_;
+            I tail_;
+            I num_;
         };
 
-        typedef _mqueue_iterator_t<T> iterator_t;
-        typedef _mqueue_const_iterator_t<T> const_iterator_t;
-
-        // reserve queue(0) for internal use. actual queue num=max_list+1
-        multi_queue_t(int node_capacity, int queue_capacity)
+        typedef _mqueue_iterator_t<multi_queue_t> iterator_t;
+        typedef _mqueue_const_iterator_t<multi_queue_t> const_iterator_t;
+
+        /*
+         *	reserve queue(0) for internal use. actual queue num=max_list+1
+         *  nodes are initialized lazily: queue(0) starts with an implicit run of never-used nodes
+         *  in index order, a node and its T are set up when it first leaves queue(0).
+         *  so construction and reset are O(queue num), and untouched memory is never committed.
+         *  the implicit run is not linked, get_head(0)/begin(0) only see nodes which were used
+         */
+        multi_queue_t(int node_capacity, int queue_capacity):
+            nodes_(NULL), data_(NULL), entries_(NULL), segs_(NULL), seg_num_(0)
         {
-            nodes_ = new qnode_t[node_capacity];
-            data_ = new T[node_capacity];
-            queues_ = new queue_t[queue_capacity+1];
+            if (!is_fit(node_capacity, queue_capacity))
+            {
+                // too large for I, get_capacity() tells
+                node_capacity = queue_capacity = 0;
+            }
+
+            // raw storage, T is constructed on first use
+            if (mqueue_grow == L)
+            {
+                segs_ = new char*[(node_capacity + SEG_NODES - 1) / SEG_NODES];
+            }
+            else if (mqueue_aos == L)
+            {
+                entries_ = (entry_t*)new char[sizeof(entry_t) * node_capacity];
+            }
+            else
+            {
+                nodes_ = new qnode_t[node_capacity];
+                data_ = (T*)new char[sizeof(T) * node_capacity];
+            }
+
+            queues_ = new queue_t[queue_capacity + 2];
             node_capacity_ = node_capacity;
             queue_capacity_ = queue_capacity;
+            external_ = false;
             init_queue();
         }
 
+        /*
+         *	place queues, nodes and data in caller's memory(e.g. shm), which must hold calc_mem_size bytes.
+         *  links are indices only, so mem can be mapped at a different address later.
+         *  attach=true reuses queue state already in mem instead of resetting it.
+         *  the memory is not released in destructor, neither is T destructed
+         */
+        multi_queue_t(void* mem, int node_capacity, int queue_capacity, bool attach):
+            nodes_(NULL), data_(NULL), entries_(NULL), segs_(NULL), seg_num_(0)
+        {
+            // segments can not live in caller's memory
+            if (!is_fit(node_capacity, queue_capacity) || mqueue_grow == L)
+            {
+                node_capacity = queue_capacity = 0;
+            }
+
+            char* p = (char*)mem;
+            queues_ = (queue_t*)p;
+            p += align_size(sizeof(queue_t) * (queue_capacity + 2));
+            if (mqueue_aos == L)
+            {
+                entries_ = (entry_t*)p;
+            }
+            else
+            {
+                nodes_ = (qnode_t*)p;
+                p += align_size(sizeof(qnode_t) * node_capacity);
+                data_ = (T*)p;
+            }
+
+            node_capacity_ = node_capacity;
+            queue_capacity_ = queue_capacity;
+            external_ = true;
+            if (!attach)
+            {
+                init_queue();
+            }
+        }
+
+        // bytes needed by multi_queue_t(mem, node_capacity, queue_capacity, attach)
+        static size_t calc_mem_size(int node_capacity, int queue_capacity)
+        {
+            size_t qsize = align_size(sizeof(queue_t) * (queue_capacity + 2));
+            if (mqueue_aos == L)
+            {
+                return qsize + align_size(sizeof(entry_t) * node_capacity);
+            }
+
+            return qsize + align_size(sizeof(qnode_t) * node_capacity) + align_size(sizeof(T) * node_capacity);
+        }
+
         virtual ~multi_queue_t()
         {
-            if (queues_)
+            if (external_)
             {
-                delete []queues_;
                 queues_ = NULL;
+                nodes_ = NULL;
+                data_ = NULL;
+                entries_ = NULL;
             }
 
-            if (nodes_)
+            // before queues_, which tells how many T are constructed
+            if (data_ || entries_ || segs_)
             {
-                delete []nodes_;
-                nodes_ = NULL;
+                destroy_data();
+            }
+
+            if (segs_)
+            {
+                for (int i = 0; i < seg_num_; ++i)
+                {
+                    ::free(segs_[i]);
+                }
+
+                delete []segs_;
+                segs_ = NULL;
+                seg_num_ = 0;
             }
 
             if (data_)
             {
-                delete []data_;
+                delete [](char*)data_;
                 data_ = NULL;
             }
 
+            if (entries_)
+            {
+                delete [](char*)entries_;
+                entries_ = NULL;
+            }
+
+            if (queues_)
+            {
+                delete []queues_;
+                queues_ = NULL;
+            }
+
+            if (nodes_)
+            {
+                delete []nodes_;
+                nodes_ = NULL;
+            }
+
             node_capacity_ = 0;
             queue_capacity_ = 0;
         }
@@ -205,27 +338,27 @@ namespace wheels
         int swap(int left, int right)
         {
             if (!is_valid_index(left) || !is_valid_index(right)
-                || nodes_[left].qid_ != nodes_[right].qid_)
+                || node(left).qid_ != node(right).qid_)
             {
                 return -1;
             }
 
             if (right == left) return 0;
-            queue_t& queue = queues_[nodes_[left].qid_];
-
-            int lp = nodes_[left].prev_;
-            int ln = nodes_[left].next_;
-            int rp = nodes_[right].prev_;
-            int rn = nodes_[right].next_;
-            if (is_valid_index(lp)) nodes_[lp].next_ = right;
-            if (is_valid_index(ln)) nodes_[ln].prev_ = right;
-            if (is_valid_index(rp)) nodes_[rp].next_ = left;
-            if (is_valid_index(rn)) nodes_[rn].prev_ = left;
-
-            nodes_[left].prev_ = (left == rp)? right: rp;
-            nodes_[left].next_ = (left == rn)? right: rn;
-            nodes_[right].prev_ = (right == lp)? left: lp;
-            nodes_[right].next_ = (right == ln)? left: ln;
+            queue_t& queue = queues_[node(left).qid_];
+
+            int lp = node(left).prev_;
+            int ln = node(left).next_;
+            int rp = node(right).prev_;
+            int rn = node(right).next_;
+            if (is_valid_index(lp)) node(lp).next_ = right;
+            if (is_valid_index(ln)) node(ln).prev_ = right;
+            if (is_valid_index(rp)) node(rp).next_ = left;
+            if (is_valid_index(rn)) node(rn).prev_ = left;
+
+            node(left).prev_ = (left == rp)? right: rp;
+            node(left).next_ = (left == rn)? right: rn;
+            node(right).prev_ = (right == lp)? left: lp;
+            node(right).next_ = (right == ln)? left: ln;
             if (left == queue.head_)
             {
                 queue.head_ = right;
@@ -269,23 +402,25 @@ namespace wheels
 
             queue_t& src_queue = queues_[src];
             queue_t& dst_queue = queues_[dst];
-            if (!is_valid_index(src_queue.head_) || dst_queue.tail_ >= node_capacity_)
+            // never-used nodes need storage, otherwise take freed ones
+            bool fresh = (0 == src && get_lazy().num_ > 0 && reserve(get_high_water() + 1) > get_high_water());
+            if ((!fresh && !is_valid_index(src_queue.head_)) || dst_queue.tail_ >= node_capacity_)
             {
                 return -1;
             }
 
-            // remove it from src.head
-            int midx = src_queue.head_;
-            qnode_t& mnode = nodes_[midx];
+            // remove it from src.head, never-used nodes go first and are not linked yet
+            int midx = fresh? materialize(dst): src_queue.head_;
+            qnode_t& mnode = node(midx);
 
-            if (mnode.next_ < 0)
+            if (!fresh && mnode.next_ < 0)
             {
                 // empty
                 init_queue(src_queue);
             }
-            else
+            else if (!fresh)
             {
-                nodes_[mnode.next_].prev_ = -1;
+                node(mnode.next_).prev_ = -1;
                 src_queue.head_ = mnode.next_;
                 --src_queue.num_;
             }
@@ -298,39 +433,254 @@ namespace wheels
             }
             else
             {
-                nodes_[dst_queue.tail_].next_ = midx;
+                node(dst_queue.tail_).next_ = midx;
             }
 
             mnode.prev_ = dst_queue.tail_;
             mnode.next_ = -1;
-            mnode.qid_ = dst;
+            set_qid(mnode, dst);
             dst_queue.tail_ = midx;
             ++dst_queue.num_;
             return 0;
         }
 
+        // move up to n nodes from queue[src].head to queue[dst].tail in one splice, return moved num
+        int move_n(int src, int dst, int n)
+        {
+            if (!is_valid_queue(src) || !is_valid_queue(dst) || n < 0)
+            {
+                return -1;
+            }
+
+            if (src == dst)
+            {
+                return 0;
+            }
+
+            // never-used nodes go first, they are consecutive
+            int fresh = 0;
+            if (0 == src)
+            {
+                fresh = (n < get_lazy().num_)? n: get_lazy().num_;
+                int avail = reserve(get_high_water() + fresh) - get_high_water();
+                fresh = (fresh < avail)? fresh: avail;
+                for (int i = 0; i < fresh; ++i)
+                {
+                    int idx = materialize(dst);
+                    node(idx).prev_ = idx - 1;
+                    node(idx).next_ = idx + 1;
+                }
+
+                if (fresh > 0)
+                {
+                    int last = get_lazy().head_ - 1;
+                    splice_tail(dst, last - fresh + 1, last, fresh);
+                }
+
+                n -= fresh;
+            }
+
+            queue_t& src_queue = queues_[src];
+            if (n > src_queue.num_)
+            {
+                n = src_queue.num_;
+            }
+
+            if (0 == n)
+            {
+                return fresh;
+            }
+
+            // find the run [first, last]
+            int first = src_queue.head_;
+            int last = first;
+            set_qid(node(last), dst);
+            for (int i = 1; i < n; ++i)
+            {
+                last = node(last).next_;
+                set_qid(node(last), dst);
+            }
+
+            // detach it from src
+            int next = node(last).next_;
+            if (next < 0)
+            {
+                init_queue(src_queue);
+            }
+            else
+            {
+                node(next).prev_ = -1;
+                src_queue.head_ = next;
+                src_queue.num_ -= n;
+            }
+
+            splice_tail(dst, first, last, n);
+            return fresh + n;
+        }
+
+        /*
+         *	move all nodes of queue[src] to queue[dst].tail(or head if to_head), return moved num.
+         *  never-used nodes stay in queue(0). links and counts are updated at once, but every moved
+         *  node gets its queue id written, so it is O(moved num), just without per node relinking
+         */
+        int splice(int src, int dst, bool to_head = false)
+        {
+            if (!is_valid_queue(src) || !is_valid_queue(dst))
+            {
+                return -1;
+            }
+
+            queue_t& src_queue = queues_[src];
+            int n = src_queue.num_;
+            if (src == dst || 0 == n)
+            {
+                return 0;
+            }
+
+            int first = src_queue.head_;
+            int last = src_queue.tail_;
+            init_queue(src_queue);
+            link_run(dst, first, last, n, to_head);
+            return n;
+        }
+
+        /*
+         *	move run [first, last] of one queue to queue[dst].tail(or head if to_head), return moved num.
+         *  the run is walked to check and count it, and once more for queue ids, O(run length)
+         */
+        int splice_range(int first, int last, int dst, bool to_head = false)
+        {
+            if (!is_valid_index(first) || !is_valid_index(last) || !is_valid_queue(dst)
+                || node(first).qid_ != node(last).qid_)
+            {
+                return -1;
+            }
+
+            // last must follow first
+            int n = 1;
+            for (int i = first; i != last; ++n)
+            {
+                i = node(i).next_;
+                if (i < 0)
+                {
+                    return -1;
+                }
+            }
+
+            move_run(first, last, n, dst, to_head);
+            return n;
+        }
+
+        /*
+         *	like splice_range, but caller tells the run has n nodes, so it is not walked to count.
+         *  last MUST follow first by n - 1 nodes. queue ids are still written one by one
+         */
+        int splice_range_n(int first, int last, int n, int dst, bool to_head = false)
+        {
+            if (!is_valid_index(first) || !is_valid_index(last) || !is_valid_queue(dst)
+                || node(first).qid_ != node(last).qid_ || n < 1 || n > queues_[node(first).qid_].num_
+                || (1 == n) != (first == last))
+            {
+                return -1;
+            }
+
+            move_run(first, last, n, dst, to_head);
+            return n;
+        }
+
+        // move node idx from its queue to queue[dst].tail
+        int move_node(int idx, int dst)
+        {
+            if (!is_valid_index(idx) || !is_valid_queue(dst))
+            {
+                return -1;
+            }
+
+            qnode_t& mnode = node(idx);
+            queue_t& dst_queue = queues_[dst];
+            if (mnode.qid_ == dst && idx == dst_queue.tail_)
+            {
+                return 0;
+            }
+
+            unlink(idx);
+
+            // append it to dst.tail
+            if (dst_queue.tail_ < 0)
+            {
+                dst_queue.head_ = idx;
+            }
+            else
+            {
+                node(dst_queue.tail_).next_ = idx;
+            }
+
+            mnode.prev_ = dst_queue.tail_;
+            mnode.next_ = -1;
+            set_qid(mnode, dst);
+            dst_queue.tail_ = idx;
+            ++dst_queue.num_;
+            return 0;
+        }
+
+        // move node idx from its queue to queue[dst].head
+        int move_node_head(int idx, int dst)
+        {
+            if (!is_valid_index(idx) || !is_valid_queue(dst))
+            {
+                return -1;
+            }
+
+            qnode_t& mnode = node(idx);
+            queue_t& dst_queue = queues_[dst];
+            if (mnode.qid_ == dst && idx == dst_queue.head_)
+            {
+                return 0;
+            }
+
+            unlink(idx);
+
+            // prepend it to dst.head
+            if (dst_queue.head_ < 0)
+            {
+                dst_queue.tail_ = idx;
+            }
+            else
+            {
+                node(dst_queue.head_).prev_ = idx;
+            }
+
+            mnode.prev_ = -1;
+            mnode.next_ = dst_queue.head_;
+            set_qid(mnode, dst);
+            dst_queue.head_ = idx;
+            ++dst_queue.num_;
+            return 0;
+        }
+
         // move src after dst, src & dst MUST in the same queue
         int move_after(int src, int dst)
         {
             if (!is_valid_index(src) || !is_valid_index(dst)
-                || nodes_[src].qid_ != nodes_[dst].qid_)
+                || node(src).qid_ != node(dst).qid_)
             {
                 return -1;
             }
 
-            queue_t& flag = queues_[nodes_[src].qid_];
+            queue_t& flag = queues_[node(src).qid_];
             if (src == dst) return 0;
-            int sp = nodes_[src].prev_;
-            int sn = nodes_[src].next_;
+            int sp = node(src).prev_;
+            int sn = node(src).next_;
 
             if (sp == dst) return 0;
 
-            if (is_valid_index(sp)) nodes_[sp].next_ = sn;
-            if (is_valid_index(sn)) nodes_[sn].prev_ = sp;
+            if (is_valid_index(sp)) node(sp).next_ = sn;
+            if (is_valid_index(sn)) node(sn).prev_ = sp;
 
-            nodes_[src].prev_ = dst;
-            nodes_[src].next_ = nodes_[dst].next_;
-            nodes_[dst].next_ = src;
+            node(src).prev_ = dst;
+            node(src).next_ = node(dst).next_;
+            if (is_valid_index(node(dst).next_)) node(node(dst).next_).prev_ = src;
+            node(dst).next_ = src;
 
             if (src == flag.head_)
             {
@@ -353,24 +703,25 @@ namespace wheels
         int move_before( int src, int dst )
         {
             if (!is_valid_index(src) || !is_valid_index(dst)
-                || nodes_[src].qid_ != nodes_[dst].qid_)
+                || node(src).qid_ != node(dst).qid_)
             {
                 return -1;
             }
 
             if (src == dst) return 0;
-            queue_t& flag = queues_[nodes_[src].qid_];
-            int sp = nodes_[src].prev_;
-            int sn = nodes_[src].next_;
+            queue_t& flag = queues_[node(src).qid_];
+            int sp = node(src).prev_;
+            int sn = node(src).next_;
 
             if (sn == dst) return 0;
 
-            if (is_valid_index(sp)) nodes_[sp].next_ = sn;
-            if (is_valid_index(sn)) nodes_[sn].prev_ = sp;
+            if (is_valid_index(sp)) node(sp).next_ = sn;
+            if (is_valid_index(sn)) node(sn).prev_ = sp;
 
-            nodes_[src].prev_ = nodes_[dst].prev_;
-            nodes_[src].next_ = dst;
-            nodes_[dst].prev_ = src;
+            node(src).prev_ = node(dst).prev_;
+            node(src).next_ = dst;
+            if (is_valid_index(node(dst).prev_)) node(node(dst).prev_).next_ = src;
+            node(dst).prev_ = src;
 
             if (src == flag.head_)
             {
@@ -391,18 +742,47 @@ namespace wheels
 
         T* get(int idx)
         {
-            return is_valid_index(idx)? &data_[idx]: NULL;
+            return is_valid_index(idx)? data(idx): NULL;
         }
 
         const T* get(int idx) const
         {
-            return is_valid_index(idx)? &data_[idx]: NULL;
+            return is_valid_index(idx)? data(idx): NULL;
         }
 
-        int get_idx(const T* data) const
+        int get_idx(const T* ptr) const
         {
-            int idx = ((size_t)data - (size_t)data_) / sizeof(T);
-            if (is_valid_index(idx) && &data_[idx] == data)
+            // ptr is inside its element either way
+            size_t base = (mqueue_aos == L)? (size_t)entries_: (size_t)data_;
+            size_t stride = (mqueue_soa == L)? sizeof(T): sizeof(entry_t);
+            if (mqueue_grow == L)
+            {
+                if (NULL == ptr || 0 == get_high_water())
+                {
+                    return -1;
+                }
+
+                // segments are SEG_BYTES aligned, the head tells its owner and index of its first element.
+                // segment heads are written once before the high water publishes them
+                const seg_head_t* head = (const seg_head_t*)((size_t)ptr & ~(size_t)(SEG_BYTES - 1));
+                if (head->owner_ != this || (size_t)ptr < (size_t)head + SEG_HEAD)
+                {
+                    return -1;
+                }
+
+                size_t i = ((size_t)ptr - (size_t)head - SEG_HEAD) / sizeof(entry_t);
+                int idx = head->first_ + (int)i;
+                if (i >= (size_t)SEG_NODES || !is_valid_index(idx)
+                    || &((const entry_t*)((const char*)head + SEG_HEAD) + i)->data_ != ptr)
+                {
+                    return -1;
+                }
+
+                return idx;
+            }
+
+            int idx = (int)(((ptrdiff_t)ptr - (ptrdiff_t)base) / (ptrdiff_t)stride);
+            if (is_valid_index(idx) && data(idx) == ptr)
             {
                 return idx;
             }
@@ -432,16 +812,18 @@ namespace wheels
 
         int get_next_id(int idx) const
         {
-            return is_valid_index(idx)? nodes_[idx].next_: -1;
+            return is_valid_index(idx)? node(idx).next_: -1;
         }
 
         int get_prev_id(int idx) const
         {
-            return is_valid_index(idx)? nodes_[idx].prev_: -1;
+            return is_valid_index(idx)? node(idx).prev_: -1;
         }
 
+        // all nodes back to never-used, T of used nodes is destructed and constructed again on next use
         void reset()
         {
+            destroy_data();
             init_queue();
         }
 
@@ -450,10 +832,16 @@ namespace wheels
             return node_capacity_;
         }
 
+        // nodes which were ever used, they are [0, get_high_water()). pairs with the release in materialize
+        int get_high_water() const
+        {
+            return __atomic_load_n(&get_lazy().head_, __ATOMIC_ACQUIRE);
+        }
+
         inline int get_num(int qid) const
         {
             if (!is_valid_queue(qid)) return -1;
-            return queues_[qid].num_;
+            return (0 == qid)? queues_[0].num_ + get_lazy().num_: queues_[qid].num_;
         }
 
         inline int get_head(int qid) const
@@ -471,7 +859,7 @@ namespace wheels
         inline int get_queue_id(int idx) const
         {
             if (!is_valid_index(idx)) return -1;
-            return nodes_[idx].qid_;
+            return __atomic_load_n(&node(idx).qid_, __ATOMIC_RELAXED);
         }
 
         static void init_queue(queue_t& q)
@@ -482,11 +870,79 @@ namespace wheels
         }
 
     private:
+        // mqueue_aos/mqueue_grow element
+        struct entry_t
+        {
+            qnode_t node_;
+            T data_;
+        };
+
+        // start of every mqueue_grow segment, followed by SEG_NODES elements
+        struct seg_head_t
+        {
+            const multi_queue_t* owner_;    // tells our segments from other memory
+            int first_;                     // index of first element
+        };
+
+        enum
+        {
+            SEG_BYTES = 65536,
+            SEG_HEAD = 64,  // keeps elements cache line aligned
+            SEG_FIT = (SEG_BYTES - SEG_HEAD) / sizeof(entry_t),
+            SEG_NODES = (SEG_FIT > 0)? SEG_FIT: 1,
+        };
+
         // deny copy-cons
         multi_queue_t(const multi_queue_t& l)
         {
         }
 
+        // SEG_NODES is a constant, so the division is a multiply
+        inline entry_t* entry(int i) const
+        {
+            return (mqueue_grow == L)? (entry_t*)(segs_[i / SEG_NODES] + SEG_HEAD) + i % SEG_NODES: entries_ + i;
+        }
+
+        inline qnode_t& node(int i) { return (mqueue_soa == L)? nodes_[i]: entry(i)->node_; }
+        inline const qnode_t& node(int i) const { return (mqueue_soa == L)? nodes_[i]: entry(i)->node_; }
+        inline T* data(int i) { return (mqueue_soa == L)? &data_[i]: &entry(i)->data_; }
+        inline const T* data(int i) const { return (mqueue_soa == L)? &data_[i]: &entry(i)->data_; }
+
+        // make sure nodes [0, end) have storage, return num of nodes which have
+        int reserve(int end)
+        {
+            if (mqueue_grow != L)
+            {
+                return node_capacity_;
+            }
+
+            // element must fit in a segment many times
+            typedef char seg_check_t[(mqueue_grow != L || SEG_FIT >= 16)? 1: -1];
+            (void)sizeof(seg_check_t);
+            while (seg_num_ * SEG_NODES < end)
+            {
+                void* seg = NULL;
+                if (0 != posix_memalign(&seg, SEG_BYTES, SEG_BYTES))
+                {
+                    break;
+                }
+
+                // segs_ only grows, a slot is never written again once nodes in it are published
+                ((seg_head_t*)seg)->owner_ = this;
+                ((seg_head_t*)seg)->first_ = seg_num_ * SEG_NODES;
+                segs_[seg_num_++] = (char*)seg;
+            }
+
+            return seg_num_ * SEG_NODES;
+        }
+
+        // indices up to node_capacity and queue ids up to queue_capacity + 1 must fit in I
+        static bool is_fit(int node_capacity, int queue_capacity)
+        {
+            long long max = ((long long)1 << (sizeof(I) * 8 - 1)) - 1;
+            return node_capacity <= max && (long long)queue_capacity + 1 <= max;
+        }
+
         void init_queue()
         {
             for (int i = 0; i <= queue_capacity_; ++i)
@@ -494,23 +950,173 @@ namespace wheels
                 init_queue(queues_[i]);
             }
 
-            // all belong to queue[0]
-            queues_[0].head_ = 0;
-            queues_[0].tail_ = node_capacity_ - 1;
-            queues_[0].num_ = node_capacity_;
-            for (int i = 0; i < node_capacity_; ++i)
+            // all belong to queue[0] as never-used nodes [head_, node_capacity_)
+            queue_t& lazy = get_lazy();
+            lazy.head_ = 0;
+            lazy.tail_ = node_capacity_ - 1;
+            lazy.num_ = node_capacity_;
+        }
+
+        // never-used nodes, stored after the last queue so it is kept in external memory too
+        inline queue_t& get_lazy() { return queues_[queue_capacity_ + 1]; }
+        inline const queue_t& get_lazy() const { return queues_[queue_capacity_ + 1]; }
+
+        // take the first never-used node for queue[qid], construct its T. caller links it
+        inline int materialize(int qid)
+        {
+            queue_t& lazy = get_lazy();
+            int idx = lazy.head_;
+            --lazy.num_;
+            new (data(idx)) T();
+            set_qid(node(idx), qid);
+            // publish the node after its storage and queue id, lock-free readers check the high water first
+            __atomic_store_n(&lazy.head_, (I)(idx + 1), __ATOMIC_RELEASE);
+            return idx;
+        }
+
+        void destroy_data()
+        {
+            if (!__has_trivial_destructor(T))
+            {
+                for (int i = 0; i < get_lazy().head_; ++i)
+                {
+                    data(i)->~T();
+                }
+            }
+        }
+
+        /*
+         *	queue id of nodes and the never-used head are written atomically, so
+         *  concurrent_multi_queue_t may read them before it knows which queue lock to take
+         */
+        static inline void set_qid(qnode_t& n, int qid)
+        {
+            __atomic_store_n(&n.qid_, (I)qid, __ATOMIC_RELAXED);
+        }
+
+        // take node idx out of its queue, links of idx are left as is
+        void unlink(int idx)
+        {
+            qnode_t& mnode = node(idx);
+            queue_t& src_queue = queues_[mnode.qid_];
+            if (mnode.prev_ < 0)
+            {
+                src_queue.head_ = mnode.next_;
+            }
+            else
             {
-                nodes_[i].qid_ = 0;
-                nodes_[i].prev_ = i - 1;
-                nodes_[i].next_ = i + 1;
+                node(mnode.prev_).next_ = mnode.next_;
             }
 
-            nodes_[node_capacity_ - 1].next_ = -1;
+            if (mnode.next_ < 0)
+            {
+                src_queue.tail_ = mnode.prev_;
+            }
+            else
+            {
+                node(mnode.next_).prev_ = mnode.prev_;
+            }
+
+            --src_queue.num_;
+        }
+
+        // take linked run [first, last] of n nodes out of its queue, link it to queue[dst]
+        void move_run(int first, int last, int n, int dst, bool to_head)
+        {
+            qnode_t& fnode = node(first);
+            qnode_t& lnode = node(last);
+            queue_t& src_queue = queues_[fnode.qid_];
+            if (fnode.prev_ < 0)
+            {
+                src_queue.head_ = lnode.next_;
+            }
+            else
+            {
+                node(fnode.prev_).next_ = lnode.next_;
+            }
+
+            if (lnode.next_ < 0)
+            {
+                src_queue.tail_ = fnode.prev_;
+            }
+            else
+            {
+                node(lnode.next_).prev_ = fnode.prev_;
+            }
+
+            src_queue.num_ -= n;
+            link_run(dst, first, last, n, to_head);
+        }
+
+        // link run [first, last] of n nodes to queue[dst] and set their queue id, O(n)
+        void link_run(int dst, int first, int last, int n, bool to_head)
+        {
+            for (int i = first; ; i = node(i).next_)
+            {
+                set_qid(node(i), dst);
+                if (i == last)
+                {
+                    break;
+                }
+            }
+
+            if (to_head)
+            {
+                splice_head(dst, first, last, n);
+            }
+            else
+            {
+                splice_tail(dst, first, last, n);
+            }
+        }
+
+        // prepend linked run [first, last] of n nodes to queue[dst].head
+        void splice_head(int dst, int first, int last, int n)
+        {
+            queue_t& dst_queue = queues_[dst];
+            if (dst_queue.head_ < 0)
+            {
+                dst_queue.tail_ = last;
+            }
+            else
+            {
+                node(dst_queue.head_).prev_ = last;
+            }
+
+            node(last).next_ = dst_queue.head_;
+            node(first).prev_ = -1;
+            dst_queue.head_ = first;
+            dst_queue.num_ += n;
+        }
+
+        // append linked run [first, last] of n nodes to queue[dst].tail
+        void splice_tail(int dst, int first, int last, int n)
+        {
+            queue_t& dst_queue = queues_[dst];
+            if (dst_queue.tail_ < 0)
+            {
+                dst_queue.head_ = first;
+            }
+            else
+            {
+                node(dst_queue.tail_).next_ = first;
+            }
+
+            node(first).prev_ = dst_queue.tail_;
+            node(last).next_ = -1;
+            dst_queue.tail_ = last;
+            dst_queue.num_ += n;
+        }
+
+        static inline size_t align_size(size_t sz)
+        {
+            return (sz + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1);
         }
 
+        // never-used nodes are not valid yet
         inline bool is_valid_index(int i) const
         {
-            return i >= 0 && i < node_capacity_;
+            return i >= 0 && i < get_high_water();
         }
         
         inline bool is_valid_queue(int i) const
@@ -519,10 +1125,15 @@ namespace wheels
         }
 
         queue_t* queues_;
-        qnode_t* nodes_;
-        T* data_;
+        qnode_t* nodes_;    // mqueue_soa only
+        T* data_;           // mqueue_soa only
+        entry_t* entries_;  // mqueue_aos only
+        char** segs_;       // mqueue_grow only, kept until destructed
+        int seg_num_;
         int node_capacity_;
         int queue_capacity_;
+        bool external_;
+        const static size_t MEM_ALIGN = 64;
     };
 }
 
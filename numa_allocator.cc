@@ -0,0 +1,133 @@
+#include <numa_allocator.h>
+#include <cstdlib>
+#include <cstring>
+
+using namespace wheels;
+
+numa_allocator_t::numa_allocator_t():
+    nodes_(NULL), node_num_(0)
+{
+}
+
+numa_allocator_t::~numa_allocator_t()
+{
+    if (nodes_)
+    {
+        delete []nodes_;
+        nodes_ = NULL;
+    }
+
+    node_num_ = 0;
+}
+
+int numa_allocator_t::initialize( allocator_t::allocator_info_t* allocators, size_t magazine_size, int flags, int huge )
+{
+    if (nodes_)
+    {
+        return -1;
+    }
+
+    int num = numa_node_num();
+    nodes_ = new thread_cache_allocator_t[num];
+    if (NULL == nodes_)
+    {
+        return -1;
+    }
+
+    node_num_ = num;
+    page_option_t opt;
+    opt.huge_ = huge;
+    for (int i = 0; i < num; ++i)
+    {
+        // no binding on single node machine
+        opt.node_ = (num > 1)? i: -1;
+        int ret = nodes_[i].initialize(allocators, magazine_size, flags, &opt);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+void* numa_allocator_t::alloc( size_t sz )
+{
+    int node = numa_current_node();
+    if (node >= node_num_)
+    {
+        node = 0;
+    }
+
+    for (int i = 0; i < node_num_; ++i)
+    {
+        void* p = nodes_[(node + i) % node_num_].alloc(sz);
+        if (p)
+        {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+int numa_allocator_t::free( void* p )
+{
+    if (NULL == p)
+    {
+        return 0;
+    }
+
+    int node = get_owner_node(p);
+    if (node < 0)
+    {
+        return -1;
+    }
+
+    return nodes_[node].free(p);
+}
+
+void* numa_allocator_t::realloc( size_t sz, void* p )
+{
+    int node = get_owner_node(p);
+    if (node < 0)
+    {
+        return NULL;
+    }
+
+    void* n = nodes_[node].realloc(sz, p);
+    if (n)
+    {
+        return n;
+    }
+
+    // owner node is exhausted, try others
+    size_t usable = nodes_[node].get_usable_size(p);
+    n = alloc(sz);
+    if (NULL == n)
+    {
+        return NULL;
+    }
+
+    memcpy(n, p, (usable < sz)? usable: sz);
+    if (nodes_[node].free(p) < 0)
+    {
+        // this should never happen
+        abort();
+    }
+
+    return n;
+}
+
+int numa_allocator_t::get_owner_node( void* p ) const
+{
+    for (int i = 0; i < node_num_; ++i)
+    {
+        if (nodes_[i].is_owner(p))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
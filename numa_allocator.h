@@ -0,0 +1,42 @@
+#ifndef _WHEELS_NUMA_ALLOCATOR_H_
+#define _WHEELS_NUMA_ALLOCATOR_H_
+
+#include <thread_cache.h>
+
+namespace wheels
+{
+    /*
+     *	numa aware front-end, thread-safe
+     *  one thread cached allocator per node, its pools bound to that node. threads alloc from
+     *  the node they are running on, and fall back to other nodes if it is exhausted
+     */
+    class numa_allocator_t
+    {
+    public:
+        numa_allocator_t();
+        ~numa_allocator_t();
+
+        // alloc one block, return the address
+        void* alloc(size_t sz);
+        // dealloc one block, return < 0 if error, coredump if fatal
+        int free(void* p);
+        // realloc, return NULL if oom or error(you can still use p), non-NULL if succ, coredump if fatal
+        void* realloc(size_t sz, void* p);
+
+        // every node gets a copy of allocators. huge: page_huge_t of pools
+        int initialize(allocator_t::allocator_info_t* allocators, size_t magazine_size,
+            int flags = allocator_t::alloc_default, int huge = huge_none);
+        int get_node_num() const { return node_num_; }
+
+    private:
+        // deny copy-cons
+        numa_allocator_t(const numa_allocator_t& c);
+        // return node owning p, -1 if none
+        int get_owner_node(void* p) const;
+
+        thread_cache_allocator_t* nodes_;
+        int node_num_;
+    };
+}
+
+#endif
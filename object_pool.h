@@ -0,0 +1,194 @@
+#ifndef _WHEELS_OBJECT_POOL_H_
+#define _WHEELS_OBJECT_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#if __cplusplus >= 201103L
+#include <utility>
+#endif
+
+namespace wheels
+{
+    /*
+     *	typed pool of T, not thread-safe
+     *  free slots are linked through their own memory and never-used slots are taken by a bump index,
+     *  so there is no per-slot metadata and initialize touches nothing.
+     *  destroy checks p is a slot of this pool, but can not tell a double destroy.
+     *  objects still alive when the pool is destructed are not destroyed
+     */
+    template<typename T>
+    class object_pool_t
+    {
+    public:
+        object_pool_t():
+            raw_(NULL), data_(NULL), free_(NULL), capacity_(0), bump_(0), used_(0)
+        {
+        }
+
+        ~object_pool_t()
+        {
+            if (raw_)
+            {
+                delete []raw_;
+                raw_ = NULL;
+            }
+
+            data_ = NULL;
+            free_ = NULL;
+            capacity_ = 0;
+            bump_ = 0;
+            used_ = 0;
+        }
+
+        int initialize(size_t capacity)
+        {
+            if (raw_ || 0 == capacity)
+            {
+                return -1;
+            }
+
+            raw_ = new char[SLOT_SIZE * capacity + SLOT_ALIGN];
+            if (NULL == raw_)
+            {
+                return -1;
+            }
+
+            data_ = (char*)(((uintptr_t)raw_ + SLOT_ALIGN - 1) & ~(uintptr_t)(SLOT_ALIGN - 1));
+            capacity_ = capacity;
+            return 0;
+        }
+
+        // raw slot for T, return NULL if pool is exhausted
+        void* alloc()
+        {
+            void* p;
+            if (free_)
+            {
+                p = free_;
+                free_ = free_->next_;
+            }
+            else if (bump_ < capacity_)
+            {
+                p = data_ + SLOT_SIZE * bump_++;
+            }
+            else
+            {
+                return NULL;
+            }
+
+            ++used_;
+            return p;
+        }
+
+        // return raw slot, return < 0 if p is not a slot of this pool
+        int free(void* p)
+        {
+            if (NULL == p)
+            {
+                return 0;
+            }
+
+            if (!is_owner(p))
+            {
+                return -1;
+            }
+
+            free_slot_t* s = (free_slot_t*)p;
+            s->next_ = free_;
+            free_ = s;
+            --used_;
+            return 0;
+        }
+
+#if __cplusplus >= 201103L
+        // construct T in a slot with args, return NULL if pool is exhausted
+        template<typename... Args>
+        T* create(Args&&... args)
+        {
+            void* p = alloc();
+            return p? new (p) T(std::forward<Args>(args)...): NULL;
+        }
+#else
+        T* create()
+        {
+            void* p = alloc();
+            return p? new (p) T(): NULL;
+        }
+
+        template<typename A1>
+        T* create(const A1& a1)
+        {
+            void* p = alloc();
+            return p? new (p) T(a1): NULL;
+        }
+
+        template<typename A1, typename A2>
+        T* create(const A1& a1, const A2& a2)
+        {
+            void* p = alloc();
+            return p? new (p) T(a1, a2): NULL;
+        }
+
+        template<typename A1, typename A2, typename A3>
+        T* create(const A1& a1, const A2& a2, const A3& a3)
+        {
+            void* p = alloc();
+            return p? new (p) T(a1, a2, a3): NULL;
+        }
+#endif
+
+        // destruct p and return its slot, return < 0 if p is not a slot of this pool
+        int destroy(T* p)
+        {
+            if (NULL == p)
+            {
+                return 0;
+            }
+
+            if (!is_owner(p))
+            {
+                return -1;
+            }
+
+            p->~T();
+            return free(p);
+        }
+
+        // true if p is the address of a slot handed out before
+        bool is_owner(const void* p) const
+        {
+            size_t off = (const char*)p - data_;
+            return (const char*)p >= data_ && off < SLOT_SIZE * bump_ && 0 == off % SLOT_SIZE;
+        }
+
+        size_t get_capacity() const { return capacity_; }
+        size_t get_used_num() const { return used_; }
+        size_t get_free_num() const { return capacity_ - used_; }
+
+    private:
+        struct free_slot_t
+        {
+            free_slot_t* next_;
+        };
+
+        enum
+        {
+            SLOT_ALIGN = (__alignof__(T) > __alignof__(free_slot_t))? __alignof__(T): __alignof__(free_slot_t),
+            SLOT_SIZE = ((sizeof(T) > sizeof(free_slot_t)? sizeof(T): sizeof(free_slot_t)) + SLOT_ALIGN - 1)
+                / SLOT_ALIGN * SLOT_ALIGN,
+        };
+
+        // deny copy-cons
+        object_pool_t(const object_pool_t& c);
+
+        char* raw_;
+        char* data_;            // SLOT_ALIGN aligned
+        free_slot_t* free_;     // freed slots
+        size_t capacity_;
+        size_t bump_;           // slots [bump_, capacity_) were never used
+        size_t used_;
+    };
+}
+
+#endif
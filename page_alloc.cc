@@ -0,0 +1,227 @@
+#include <page_alloc.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+// from linux/mempolicy.h, avoid depending on libnuma
+#define W_MPOL_BIND 2
+
+size_t wheels::page_size()
+{
+    static size_t psize = sysconf(_SC_PAGESIZE);
+    return psize;
+}
+
+static size_t read_huge_page_size()
+{
+    FILE* fp = fopen("/proc/meminfo", "r");
+    if (NULL == fp)
+    {
+        return 0;
+    }
+
+    char line[256];
+    size_t kb = 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (1 == sscanf(line, "Hugepagesize: %zu kB", &kb))
+        {
+            break;
+        }
+    }
+
+    fclose(fp);
+    return kb * 1024;
+}
+
+size_t wheels::huge_page_size()
+{
+    static size_t hsize = read_huge_page_size();
+    return hsize;
+}
+
+static int read_numa_node_num()
+{
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (NULL == dir)
+    {
+        return 1;
+    }
+
+    int num = 1;
+    struct dirent* ent;
+    while (NULL != (ent = readdir(dir)))
+    {
+        int node;
+        if (1 == sscanf(ent->d_name, "node%d", &node) && node + 1 > num)
+        {
+            num = node + 1;
+        }
+    }
+
+    closedir(dir);
+    return num;
+}
+
+int wheels::numa_node_num()
+{
+    static int num = read_numa_node_num();
+    return num;
+}
+
+// cpus beyond it ask the kernel for their node
+#define MAX_NUMA_CPU 4096
+
+// numa node of every cpu, filled once from sysfs
+static short cpu_node_map[MAX_NUMA_CPU];
+
+static int read_cpu_node_map()
+{
+    char path[64];
+    int num = wheels::numa_node_num();
+    for (int node = 0; node < num; ++node)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", node);
+        DIR* dir = opendir(path);
+        if (NULL == dir)
+        {
+            continue;
+        }
+
+        struct dirent* ent;
+        while (NULL != (ent = readdir(dir)))
+        {
+            int cpu;
+            if (1 == sscanf(ent->d_name, "cpu%d", &cpu) && cpu >= 0 && cpu < MAX_NUMA_CPU)
+            {
+                cpu_node_map[cpu] = (short)node;
+            }
+        }
+
+        closedir(dir);
+    }
+
+    return 0;
+}
+
+int wheels::numa_current_node()
+{
+    static int inited = read_cpu_node_map();
+    (void)inited;
+    // sched_getcpu goes through vdso, no syscall on the alloc path
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && cpu < MAX_NUMA_CPU)
+    {
+        return cpu_node_map[cpu];
+    }
+
+    unsigned c = 0, node = 0;
+    if (syscall(SYS_getcpu, &c, &node, NULL) < 0)
+    {
+        return 0;
+    }
+
+    return node;
+}
+
+void* wheels::page_map( size_t sz, size_t align )
+{
+    return page_map(sz, align, page_option_t());
+}
+
+void* wheels::page_map( size_t sz, size_t align, const page_option_t& opt )
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    size_t gran = page_size();
+    if (huge_explicit == opt.huge_)
+    {
+        gran = huge_page_size();
+        if (0 == gran || 0 != sz % gran)
+        {
+            return NULL;
+        }
+
+        flags |= MAP_HUGETLB;
+    }
+
+    if (align < gran)
+    {
+        align = gran;
+    }
+
+    // over-map and trim both ends to get an aligned range
+    size_t msize = sz + align - gran;
+    char* p = (char*)mmap(NULL, msize, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (MAP_FAILED == p)
+    {
+        return NULL;
+    }
+
+    char* ap = (char*)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+    if (ap > p)
+    {
+        munmap(p, ap - p);
+    }
+
+    if (p + msize > ap + sz)
+    {
+        munmap(ap + sz, p + msize - ap - sz);
+    }
+
+    if (huge_transparent == opt.huge_)
+    {
+        // best effort
+        madvise(ap, sz, MADV_HUGEPAGE);
+    }
+
+    if (opt.node_ >= 0)
+    {
+        // pages are not touched yet, so they will be faulted in on the node
+        unsigned long mask[16];
+        memset(mask, 0, sizeof(mask));
+        size_t bits = sizeof(unsigned long) * 8;
+        if ((size_t)opt.node_ >= sizeof(mask) * 8)
+        {
+            munmap(ap, sz);
+            return NULL;
+        }
+
+        mask[opt.node_ / bits] |= 1UL << (opt.node_ % bits);
+        if (syscall(SYS_mbind, ap, sz, W_MPOL_BIND, mask, sizeof(mask) * 8, 0) < 0)
+        {
+            munmap(ap, sz);
+            return NULL;
+        }
+    }
+
+    return ap;
+}
+
+void wheels::page_unmap( void* p, size_t sz )
+{
+    if (p)
+    {
+        munmap(p, sz);
+    }
+}
+
+int wheels::page_release( void* p, size_t sz )
+{
+    return madvise(p, sz, MADV_DONTNEED);
+}
+
+void* wheels::page_remap( void* p, size_t old_sz, size_t new_sz )
+{
+    void* n = mremap(p, old_sz, new_sz, MREMAP_MAYMOVE);
+    return (MAP_FAILED == n)? NULL: n;
+}
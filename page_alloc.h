@@ -0,0 +1,45 @@
+#ifndef _WHEELS_PAGE_ALLOC_H_
+#define _WHEELS_PAGE_ALLOC_H_
+
+#include <cstddef>
+
+namespace wheels
+{
+    enum page_huge_t
+    {
+        huge_none = 0,
+        huge_transparent = 1,   // madvise(MADV_HUGEPAGE), falls back to small pages silently
+        huge_explicit = 2,      // MAP_HUGETLB, needs reserved hugetlb pages. size must be multiple of huge_page_size
+    };
+
+    struct page_option_t
+    {
+        page_option_t(): huge_(huge_none), node_(-1)
+        {
+        }
+
+        int huge_;  // page_huge_t
+        int node_;  // bind pages to this numa node, -1 for default policy
+    };
+
+    // system page size
+    size_t page_size();
+    // default huge page size, 0 if unknown
+    size_t huge_page_size();
+    // number of numa nodes, 1 if not numa
+    int numa_node_num();
+    // numa node of calling thread's cpu, 0 if unknown
+    int numa_current_node();
+
+    // map sz bytes from os, aligned to align(power of 2). return NULL if failed
+    void* page_map(size_t sz, size_t align);
+    void* page_map(size_t sz, size_t align, const page_option_t& opt);
+    // return pages to os
+    void page_unmap(void* p, size_t sz);
+    // drop physical pages but keep the address range, pages are zero-filled on next touch
+    int page_release(void* p, size_t sz);
+    // resize mapping of p to new_sz bytes, in place if possible, moved otherwise. return NULL if failed(p is intact)
+    void* page_remap(void* p, size_t old_sz, size_t new_sz);
+}
+
+#endif
@@ -62,7 +62,7 @@ namespace wheels
     public:
         llrbtree_t()
         {
-            initialize();
+            initialize(NULL);
         }
 
         virtual ~llrbtree_t()
@@ -77,6 +77,7 @@ namespace wheels
             return 0;
         }
 
+        // drop all nodes without freeing them, pair with a bulk reset allocator like arena_allocator_t
         void finalize()
         {
             root_ = NULL;
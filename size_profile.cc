@@ -0,0 +1,334 @@
+#include <size_profile.h>
+#include <cstring>
+
+using namespace wheels;
+
+// sz rounded up to g, at least 1
+static size_t round_size(size_t sz, size_t g)
+{
+    size_t s = (sz + g - 1) / g * g;
+    return (0 == s)? g: s;
+}
+
+// min power of 2 >= v
+static size_t ceil_pow2(size_t v)
+{
+    size_t n = 1;
+    while (n < v)
+    {
+        n <<= 1;
+    }
+
+    return n;
+}
+
+size_profile_t::size_profile_t():
+    max_size_(0), over_size_(0), alloc_num_(NULL), live_(NULL), peak_(NULL),
+    lives_(NULL), live_cap_(0), live_num_(0), dropped_num_(0)
+{
+}
+
+size_profile_t::~size_profile_t()
+{
+    if (alloc_num_)
+    {
+        delete []alloc_num_;
+        alloc_num_ = NULL;
+    }
+
+    if (live_)
+    {
+        delete []live_;
+        live_ = NULL;
+    }
+
+    if (peak_)
+    {
+        delete []peak_;
+        peak_ = NULL;
+    }
+
+    if (lives_)
+    {
+        delete []lives_;
+        lives_ = NULL;
+    }
+
+    live_num_ = 0;
+}
+
+int size_profile_t::initialize( size_t max_size, size_t max_live )
+{
+    if (alloc_num_ || 0 == max_size || 0 == max_live)
+    {
+        return -1;
+    }
+
+    // one more bucket for larger sizes
+    max_size_ = max_size;
+    alloc_num_ = new uint64_t[max_size + 2];
+    live_ = new uint64_t[max_size + 2];
+    peak_ = new uint64_t[max_size + 2];
+    // keep table at most half full
+    live_cap_ = ceil_pow2(max_live * 2);
+    lives_ = new live_t[live_cap_];
+    if (NULL == alloc_num_ || NULL == live_ || NULL == peak_ || NULL == lives_)
+    {
+        return -1;
+    }
+
+    reset();
+    return 0;
+}
+
+void size_profile_t::reset()
+{
+    memset(alloc_num_, 0, (max_size_ + 2) * sizeof(uint64_t));
+    memset(live_, 0, (max_size_ + 2) * sizeof(uint64_t));
+    memset(peak_, 0, (max_size_ + 2) * sizeof(uint64_t));
+    memset(lives_, 0, live_cap_ * sizeof(live_t));
+    over_size_ = 0;
+    live_num_ = 0;
+    dropped_num_ = 0;
+}
+
+void size_profile_t::record_alloc( void* p, size_t sz )
+{
+    if (NULL == p)
+    {
+        return;
+    }
+
+    size_t b = get_bucket(sz);
+    if (b > max_size_ && sz > over_size_)
+    {
+        over_size_ = sz;
+    }
+
+    ++alloc_num_[b];
+    if (live_num_ >= live_cap_ / 2)
+    {
+        ++dropped_num_;
+        return;
+    }
+
+    live_t& l = lives_[find_live(p)];
+    if (l.ptr_)
+    {
+        // not freed through us, drop the stale record
+        --live_[get_bucket(l.size_)];
+        --live_num_;
+    }
+
+    l.ptr_ = p;
+    l.size_ = sz;
+    ++live_num_;
+    if (++live_[b] > peak_[b])
+    {
+        peak_[b] = live_[b];
+    }
+}
+
+void size_profile_t::record_free( void* p )
+{
+    if (0 == live_num_)
+    {
+        return;
+    }
+
+    size_t i = find_live(p);
+    if (NULL == lives_[i].ptr_)
+    {
+        return;
+    }
+
+    --live_[get_bucket(lives_[i].size_)];
+    --live_num_;
+
+    // backward shift deletion, keeps probe chains intact without tombstones
+    size_t mask = live_cap_ - 1;
+    size_t j = i;
+    while (true)
+    {
+        j = (j + 1) & mask;
+        if (NULL == lives_[j].ptr_)
+        {
+            break;
+        }
+
+        size_t home = hash_ptr(lives_[j].ptr_) & mask;
+        // move j to hole i if its home is not in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            lives_[i] = lives_[j];
+            i = j;
+        }
+    }
+
+    lives_[i].ptr_ = NULL;
+}
+
+size_t size_profile_t::find_live( void* p ) const
+{
+    size_t mask = live_cap_ - 1;
+    size_t i = hash_ptr(p) & mask;
+    while (lives_[i].ptr_ && lives_[i].ptr_ != p)
+    {
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+uint64_t size_profile_t::hash_ptr( void* p )
+{
+    uint64_t h = (uint64_t)(uintptr_t)p;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+size_t size_profile_t::get_stats( size_stat_t* out, size_t n ) const
+{
+    size_t num = 0;
+    for (size_t b = 0; b <= max_size_ + 1; ++b)
+    {
+        if (0 == alloc_num_[b])
+        {
+            continue;
+        }
+
+        if (num < n)
+        {
+            out[num].size_ = (b > max_size_)? over_size_: b;
+            out[num].alloc_num_ = alloc_num_[b];
+            out[num].peak_live_ = peak_[b];
+        }
+
+        ++num;
+    }
+
+    return num;
+}
+
+int size_profile_t::generate( size_t budget, size_t max_classes, int flags, allocator_t::allocator_info_t* out ) const
+{
+    size_t k = get_stats(NULL, 0);
+    if (0 == k || 0 == max_classes || NULL == out)
+    {
+        return -1;
+    }
+
+    size_stat_t* st = new size_stat_t[k];
+    get_stats(st, k);
+
+    // coarsen sizes until the dp is small enough, a bucket is sized by its largest size.
+    // never finer than MIN_ALIGN, so every class keeps payloads aligned
+    size_t g = MIN_ALIGN;
+    size_t dnum;
+    do
+    {
+        dnum = 0;
+        size_t last = 0;
+        for (size_t i = 0; i < k; ++i)
+        {
+            size_t s = round_size(st[i].size_, g);
+            if (0 == i || s != last)
+            {
+                ++dnum;
+                last = s;
+            }
+        }
+
+        g = (dnum > MAX_DP_SIZES)? g * 2: g;
+    } while (dnum > MAX_DP_SIZES);
+
+    size_t* sizes = new size_t[dnum];
+    uint64_t* demand = new uint64_t[dnum + 1];   // prefix sums of peaks
+    demand[0] = 0;
+    dnum = 0;
+    for (size_t i = 0; i < k; ++i)
+    {
+        size_t s = round_size(st[i].size_, g);
+        // a size seen at all needs at least one block
+        uint64_t d = (st[i].peak_live_ > 0)? st[i].peak_live_: 1;
+        if (0 == dnum || sizes[dnum - 1] != s)
+        {
+            sizes[dnum] = s;
+            demand[dnum + 1] = demand[dnum];
+            ++dnum;
+        }
+
+        demand[dnum] += d;
+    }
+
+    delete []st;
+
+    // f[c][j]: min bytes to hold sizes [0, j] with c + 1 classes, class c ends at j
+    // heads are padded to the payload alignment
+    size_t head = allocator_t::get_head_size(flags);
+    size_t over = (head + MIN_ALIGN - 1) / MIN_ALIGN * MIN_ALIGN + BLOCK_META_SIZE;
+    size_t m = (max_classes < dnum)? max_classes: dnum;
+    uint64_t* f = new uint64_t[m * dnum];
+    int* from = new int[m * dnum];
+    for (size_t j = 0; j < dnum; ++j)
+    {
+        f[j] = demand[j + 1] * (sizes[j] + over);
+        from[j] = 0;
+    }
+
+    for (size_t c = 1; c < m; ++c)
+    {
+        for (size_t j = c; j < dnum; ++j)
+        {
+            uint64_t best = UINT64_MAX;
+            int bi = j;
+            // last class holds sizes [i, j]
+            for (size_t i = c; i <= j; ++i)
+            {
+                uint64_t v = f[(c - 1) * dnum + i - 1] + (demand[j + 1] - demand[i]) * (sizes[j] + over);
+                if (v < best)
+                {
+                    best = v;
+                    bi = i;
+                }
+            }
+
+            f[c * dnum + j] = best;
+            from[c * dnum + j] = bi;
+        }
+    }
+
+    // fewest classes reaching the min
+    size_t bc = 0;
+    for (size_t c = 1; c < m; ++c)
+    {
+        if (f[c * dnum + dnum - 1] < f[bc * dnum + dnum - 1])
+        {
+            bc = c;
+        }
+    }
+
+    double scale = (budget > 0)? (double)budget / f[bc * dnum + dnum - 1]: 1.0;
+    int j = dnum - 1;
+    for (int c = bc; c >= 0; --c)
+    {
+        int i = from[c * dnum + j];
+        uint64_t cap = (uint64_t)((demand[j + 1] - demand[i]) * scale);
+        out[c].bsize_ = sizes[j];
+        out[c].capacity_ = (cap > 0)? cap: 1;
+        out[c].align_ = MIN_ALIGN;
+        j = i - 1;
+    }
+
+    out[bc + 1].bsize_ = 0;
+    out[bc + 1].capacity_ = 0;
+    out[bc + 1].align_ = 0;
+
+    delete []f;
+    delete []from;
+    delete []sizes;
+    delete []demand;
+    return bc + 1;
+}
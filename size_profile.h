@@ -0,0 +1,82 @@
+#ifndef _WHEELS_SIZE_PROFILE_H_
+#define _WHEELS_SIZE_PROFILE_H_
+
+#include <allocator.h>
+
+namespace wheels
+{
+    /*
+     *	request size profile, not thread-safe, attach with allocator_t::set_size_profile
+     *  records how often each size is requested and the peak live count of each size,
+     *  then generates a size class table for allocator_t::initialize from it.
+     *  sizes > max_size are folded into one bucket sized by the largest of them
+     */
+    class size_profile_t
+    {
+    public:
+        struct size_stat_t
+        {
+            size_t size_;
+            uint64_t alloc_num_;
+            uint64_t peak_live_;
+        };
+
+        size_profile_t();
+        ~size_profile_t();
+
+        // max_live: blocks tracked at the same time, allocs beyond it are counted but not tracked
+        int initialize(size_t max_size = 65536, size_t max_live = 1 << 20);
+        void record_alloc(void* p, size_t sz);
+        // p is ignored if not tracked
+        void record_free(void* p);
+        void reset();
+
+        // stats of requested sizes into out in ascending size order, return size num
+        size_t get_stats(size_stat_t* out, size_t n) const;
+        // allocs not tracked for full table
+        uint64_t get_dropped_num() const { return dropped_num_; }
+
+        /*
+         *	generate up to max_classes classes into out, which needs max_classes + 1 entries(ends with bsize_ == 0).
+         *  classes are chosen by dynamic programming to minimize bytes of blocks, heads and per block
+         *  metadata needed to hold the peak live count of every size. capacities are then scaled to
+         *  fill budget bytes, 0 means exactly the peaks. flags: allocator_t::alloc_flag_t to use.
+         *  class sizes are multiples of 16 and payloads 16 aligned, so any type fits.
+         *  return class num, < 0 if nothing was recorded
+         */
+        int generate(size_t budget, size_t max_classes, int flags, allocator_t::allocator_info_t* out) const;
+
+    private:
+        struct live_t
+        {
+            void* ptr_;     // NULL if slot is empty
+            size_t size_;
+        };
+
+        enum
+        {
+            MAX_DP_SIZES = 1024,    // sizes are coarsened to keep the dp table small
+            BLOCK_META_SIZE = 16,   // queue node & flag of each block in fixed_size_allocator_t
+            MIN_ALIGN = 16,         // class size granularity and payload alignment, like malloc
+        };
+
+        // deny copy-cons
+        size_profile_t(const size_profile_t& c);
+        // bucket of sz, max_size_ + 1 for larger ones
+        inline size_t get_bucket(size_t sz) const { return (sz > max_size_)? max_size_ + 1: sz; }
+        size_t find_live(void* p) const;
+        static uint64_t hash_ptr(void* p);
+
+        size_t max_size_;
+        size_t over_size_;      // largest size > max_size_
+        uint64_t* alloc_num_;   // per bucket
+        uint64_t* live_;
+        uint64_t* peak_;
+        live_t* lives_;         // open addressing by pointer, linear probing
+        size_t live_cap_;       // power of 2
+        size_t live_num_;
+        uint64_t dropped_num_;
+    };
+}
+
+#endif
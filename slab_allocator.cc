@@ -0,0 +1,415 @@
+#include <slab_allocator.h>
+#include <cstdlib>
+#include <cstring>
+
+using namespace wheels;
+
+slab_allocator_t::slab_allocator_t():
+    bsize_(0), hsize_(0), slab_capacity_(0), capacity_(0), used_num_(0), slab_num_(0)
+{
+    memset(lists_, 0, sizeof(lists_));
+}
+
+slab_allocator_t::~slab_allocator_t()
+{
+    for (int i = 0; i < list_num; ++i)
+    {
+        while (lists_[i].head_)
+        {
+            delete_slab(lists_[i].head_);
+        }
+    }
+
+    if (opt_.reserve_)
+    {
+        opt_.reserve_->remove_client(this);
+        opt_.reserve_ = NULL;
+    }
+
+    bsize_ = 0;
+    capacity_ = 0;
+    used_num_ = 0;
+}
+
+int slab_allocator_t::initialize( size_t bsize, const option_t& opt )
+{
+    if (bsize_ || bsize <= 0 || opt.slab_size_ < page_size()
+        || 0 != (opt.slab_size_ & (opt.slab_size_ - 1))
+        || (opt.reserve_ && opt.reserve_->get_slab_size() != opt.slab_size_))
+    {
+        return -1;
+    }
+
+    // bitmap size depends on block num, and vice versa
+    size_t n = (opt.slab_size_ - sizeof(slab_t)) / bsize;
+    size_t hsize = 0;
+    do
+    {
+        hsize = (sizeof(slab_t) + (n + 63) / 64 * sizeof(uint64_t) + 63) & ~(size_t)63;
+        n = (hsize < opt.slab_size_)? (opt.slab_size_ - hsize) / bsize: 0;
+    } while (hsize + n * bsize > opt.slab_size_);
+
+    if (0 == n)
+    {
+        return -1;
+    }
+
+    if (opt.reserve_ && opt.reserve_->add_client(this) < 0)
+    {
+        return -1;
+    }
+
+    bsize_ = bsize;
+    hsize_ = hsize;
+    slab_capacity_ = n;
+    opt_ = opt;
+    return 0;
+}
+
+void* slab_allocator_t::alloc()
+{
+    slab_t* s = lists_[list_partial].head_;
+    if (NULL == s)
+    {
+        s = lists_[list_empty].head_;
+    }
+
+    if (NULL == s)
+    {
+        s = lists_[list_released].head_;
+    }
+
+    if (NULL == s)
+    {
+        s = new_slab();
+        if (NULL == s)
+        {
+            // out of memory
+            return NULL;
+        }
+    }
+
+    char* b;
+    if (s->free_)
+    {
+        b = (char*)s->free_;
+        s->free_ = *(void**)b;
+    }
+    else
+    {
+        b = slab_blocks(s) + s->bump_ * bsize_;
+        ++s->bump_;
+    }
+
+    size_t id = (b - slab_blocks(s)) / bsize_;
+    s->bitmap_[id / 64] |= (uint64_t)1 << (id % 64);
+    ++s->used_;
+    ++used_num_;
+    uint32_t list = (s->used_ >= slab_capacity_)? list_full: list_partial;
+    if (list != s->list_)
+    {
+        unlink(s);
+        link(s, list);
+    }
+
+    return b;
+}
+
+int slab_allocator_t::free( void* p )
+{
+    if (NULL == p)
+    {
+        return 0;
+    }
+
+    slab_t* s = address_to_slab(p);
+    char* blocks = slab_blocks(s);
+    if (s->owner_ != this || (char*)p < blocks)
+    {
+        return -1;
+    }
+
+    size_t id = ((char*)p - blocks) / bsize_;
+    uint64_t mask = (uint64_t)1 << (id % 64);
+    if (id >= slab_capacity_ || blocks + id * bsize_ != p || 0 == (s->bitmap_[id / 64] & mask))
+    {
+        return -1;
+    }
+
+    s->bitmap_[id / 64] &= ~mask;
+    *(void**)p = s->free_;
+    s->free_ = p;
+    --s->used_;
+    --used_num_;
+    if (0 == s->used_)
+    {
+        unlink(s);
+        link(s, list_empty);
+        shrink();
+    }
+    else if (list_full == s->list_)
+    {
+        unlink(s);
+        link(s, list_partial);
+    }
+
+    return 0;
+}
+
+slab_allocator_t::slab_t* slab_allocator_t::new_slab()
+{
+    if (opt_.max_capacity_ > 0 && capacity_ + slab_capacity_ > opt_.max_capacity_)
+    {
+        return NULL;
+    }
+
+    slab_t* s = (slab_t*)(opt_.reserve_? opt_.reserve_->get()
+        : page_map(opt_.slab_size_, opt_.slab_size_, opt_.page_));
+    if (NULL == s)
+    {
+        return NULL;
+    }
+
+    // fresh pages are zero-filled, a reserve hands back whatever the last owner left in the bitmap
+    if (opt_.reserve_)
+    {
+        memset(s->bitmap_, 0, hsize_ - sizeof(slab_t));
+    }
+
+    s->owner_ = this;
+    s->prev_ = NULL;
+    s->next_ = NULL;
+    s->free_ = NULL;
+    s->used_ = 0;
+    s->bump_ = 0;
+    s->list_ = list_none;
+    capacity_ += slab_capacity_;
+    ++slab_num_;
+    link(s, list_empty);
+    return s;
+}
+
+void slab_allocator_t::delete_slab( slab_t* s )
+{
+    unlink(s);
+    capacity_ -= slab_capacity_;
+    --slab_num_;
+    if (opt_.reserve_)
+    {
+        s->owner_ = NULL;
+        opt_.reserve_->put(s);
+        return;
+    }
+
+    page_unmap(s, opt_.slab_size_);
+}
+
+size_t slab_allocator_t::release_empty()
+{
+    size_t num = 0;
+    while (lists_[list_empty].head_)
+    {
+        delete_slab(lists_[list_empty].head_);
+        ++num;
+    }
+
+    while (lists_[list_released].head_)
+    {
+        delete_slab(lists_[list_released].head_);
+        ++num;
+    }
+
+    return num;
+}
+
+void slab_allocator_t::link( slab_t* s, uint32_t list )
+{
+    slab_list_head_t& l = lists_[list];
+    s->list_ = list;
+    s->prev_ = NULL;
+    s->next_ = l.head_;
+    if (l.head_)
+    {
+        l.head_->prev_ = s;
+    }
+
+    l.head_ = s;
+    ++l.num_;
+}
+
+void slab_allocator_t::unlink( slab_t* s )
+{
+    if (list_none == s->list_)
+    {
+        return;
+    }
+
+    slab_list_head_t& l = lists_[s->list_];
+    if (s->prev_)
+    {
+        s->prev_->next_ = s->next_;
+    }
+    else
+    {
+        l.head_ = s->next_;
+    }
+
+    if (s->next_)
+    {
+        s->next_->prev_ = s->prev_;
+    }
+
+    s->prev_ = NULL;
+    s->next_ = NULL;
+    s->list_ = list_none;
+    --l.num_;
+}
+
+void slab_allocator_t::shrink()
+{
+    if (release_none == opt_.policy_)
+    {
+        return;
+    }
+
+    while (lists_[list_empty].num_ > opt_.max_empty_)
+    {
+        slab_t* s = lists_[list_empty].head_;
+        // hugetlb pages can only be dropped as a whole. reserve decides for its slabs
+        if (release_munmap == opt_.policy_ || huge_explicit == opt_.page_.huge_ || opt_.reserve_)
+        {
+            delete_slab(s);
+            continue;
+        }
+
+        // keep the header page, drop the rest
+        size_t psize = page_size();
+        char* start = (char*)(((uintptr_t)slab_blocks(s) + psize - 1) & ~(uintptr_t)(psize - 1));
+        page_release(start, (char*)s + opt_.slab_size_ - start);
+        s->free_ = NULL;
+        s->bump_ = 0;
+        unlink(s);
+        link(s, list_released);
+    }
+}
+
+slab_reserve_t::slab_reserve_t():
+    base_(NULL), slab_size_(0), slab_num_(0), free_(NULL), free_num_(0), bump_(0),
+    policy_(slab_allocator_t::release_madvise), reclaim_num_(0), client_num_(0)
+{
+}
+
+slab_reserve_t::~slab_reserve_t()
+{
+    if (base_)
+    {
+        page_unmap(base_, slab_size_ * slab_num_);
+        base_ = NULL;
+    }
+
+    if (free_)
+    {
+        delete []free_;
+        free_ = NULL;
+    }
+
+    slab_num_ = 0;
+    free_num_ = 0;
+    bump_ = 0;
+}
+
+int slab_reserve_t::initialize( size_t slab_size, size_t slab_num, const page_option_t& opt, int policy )
+{
+    if (base_ || slab_size < page_size() || 0 != (slab_size & (slab_size - 1))
+        || 0 == slab_num || slab_num > UINT32_MAX || slab_allocator_t::release_munmap == policy)
+    {
+        return -1;
+    }
+
+    // address range only, pages are committed when slabs are touched
+    base_ = (char*)page_map(slab_size * slab_num, slab_size, opt);
+    free_ = new uint32_t[slab_num];
+    if (NULL == base_ || NULL == free_)
+    {
+        return -1;
+    }
+
+    slab_size_ = slab_size;
+    slab_num_ = slab_num;
+    policy_ = policy;
+    return 0;
+}
+
+void* slab_reserve_t::get()
+{
+    while (0 == get_free_num())
+    {
+        if (reclaim() < 0)
+        {
+            return NULL;
+        }
+    }
+
+    size_t idx = (free_num_ > 0)? free_[--free_num_]: bump_++;
+    return base_ + idx * slab_size_;
+}
+
+void slab_reserve_t::put( void* s )
+{
+    if (!is_owner(s) || 0 != ((char*)s - base_) % slab_size_)
+    {
+        // FATAL: should never happen!
+        abort();
+    }
+
+    if (slab_allocator_t::release_madvise == policy_)
+    {
+        page_release(s, slab_size_);
+    }
+
+    free_[free_num_++] = ((char*)s - base_) / slab_size_;
+}
+
+int slab_reserve_t::add_client( slab_allocator_t* c )
+{
+    if (client_num_ >= MAX_CLIENT)
+    {
+        return -1;
+    }
+
+    clients_[client_num_++] = c;
+    return 0;
+}
+
+void slab_reserve_t::remove_client( slab_allocator_t* c )
+{
+    for (int i = 0; i < client_num_; ++i)
+    {
+        if (clients_[i] == c)
+        {
+            clients_[i] = clients_[--client_num_];
+            return;
+        }
+    }
+}
+
+int slab_reserve_t::reclaim()
+{
+    slab_allocator_t* victim = NULL;
+    for (int i = 0; i < client_num_; ++i)
+    {
+        if (clients_[i]->get_empty_num() > 0
+            && (NULL == victim || clients_[i]->get_empty_num() > victim->get_empty_num()))
+        {
+            victim = clients_[i];
+        }
+    }
+
+    if (NULL == victim)
+    {
+        return -1;
+    }
+
+    reclaim_num_ += victim->release_empty();
+    return 0;
+}
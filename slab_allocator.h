@@ -0,0 +1,191 @@
+#ifndef _WHEELS_SLAB_ALLOCATOR_H_
+#define _WHEELS_SLAB_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <page_alloc.h>
+
+namespace wheels
+{
+    class slab_reserve_t;
+
+    /*
+     *	growable fixed size allocator, same api as fixed_size_allocator_t
+     *  blocks live in slab_size aligned slabs mapped on demand, so the owning slab of a block
+     *  is found by masking its address. fully-empty slabs beyond max_empty are given back to os,
+     *  or to the reserve if slabs are drawn from a slab_reserve_t shared with other allocators
+     */
+    class slab_allocator_t
+    {
+    public:
+        enum release_policy_t
+        {
+            release_none = 0,       // keep empty slabs forever
+            release_madvise = 1,    // drop physical pages, keep address range
+            release_munmap = 2,     // unmap slab
+        };
+
+        struct option_t
+        {
+            option_t():
+                slab_size_(1 << 20), max_empty_(1), max_capacity_(0), policy_(release_munmap), reserve_(NULL)
+            {
+            }
+
+            size_t slab_size_;      // power of 2, >= page size
+            size_t max_empty_;      // empty slabs kept before releasing
+            size_t max_capacity_;   // max blocks, 0 means unlimited
+            int policy_;            // release_policy_t
+            page_option_t page_;    // huge pages/numa node of slabs
+            // draw slabs from reserve instead of os, slab_size_ must match. page_ is ignored
+            slab_reserve_t* reserve_;
+        };
+
+        slab_allocator_t();
+        ~slab_allocator_t();
+
+        // alloc one block, return the address
+        void* alloc();
+        // dealloc one block, return < 0 if error. p must be NULL or in a mapped slab
+        int free(void* p);
+
+        int initialize(size_t bsize, const option_t& opt);
+        size_t get_bsize() const { return bsize_; }
+        // blocks in mapped slabs
+        size_t get_capacity() const { return capacity_; }
+        size_t get_used_num() const { return used_num_; }
+        size_t get_free_num() const { return capacity_ - used_num_; }
+        size_t get_slab_num() const { return slab_num_; }
+        // blocks per slab
+        size_t get_slab_capacity() const { return slab_capacity_; }
+        // empty slabs kept, they can be released at once
+        size_t get_empty_num() const { return lists_[list_empty].num_ + lists_[list_released].num_; }
+        // give all empty slabs back, return released num
+        size_t release_empty();
+        // owner of block p, p must be in a slab of slab_size
+        static slab_allocator_t* get_owner(void* p, size_t slab_size)
+        {
+            slab_t* s = (slab_t*)((uintptr_t)p & ~(uintptr_t)(slab_size - 1));
+            return s->owner_;
+        }
+
+    private:
+        struct slab_t
+        {
+            slab_allocator_t* owner_;
+            slab_t* prev_;
+            slab_t* next_;
+            void* free_;        // intrusive free list of returned blocks
+            uint32_t used_;
+            uint32_t bump_;     // blocks >= bump_ were never used
+            uint32_t list_;     // slab_list_t
+            uint64_t bitmap_[0];// used blocks
+        };
+
+        enum slab_list_t
+        {
+            list_none = 0,
+            list_partial = 1,
+            list_empty = 2,
+            list_released = 3,  // empty, pages released by madvise
+            list_full = 4,
+            list_num,
+        };
+
+        struct slab_list_head_t
+        {
+            slab_t* head_;
+            size_t num_;
+        };
+
+        // deny copy-cons
+        slab_allocator_t(const slab_allocator_t& c);
+
+        inline slab_t* address_to_slab(void* p) const
+        {
+            return (slab_t*)((uintptr_t)p & ~(uintptr_t)(opt_.slab_size_ - 1));
+        }
+
+        inline char* slab_blocks(slab_t* s) const
+        {
+            return (char*)s + hsize_;
+        }
+
+        slab_t* new_slab();
+        void delete_slab(slab_t* s);
+        void link(slab_t* s, uint32_t list);
+        void unlink(slab_t* s);
+        // release empty slabs exceeding max_empty_
+        void shrink();
+
+        size_t bsize_;
+        size_t hsize_;          // slab header, including bitmap
+        size_t slab_capacity_;
+        size_t capacity_;
+        size_t used_num_;
+        size_t slab_num_;
+        option_t opt_;
+        slab_list_head_t lists_[list_num];
+    };
+
+    /*
+     *	page level reserve shared by slab allocators, not thread-safe
+     *  one address range is mapped up front and committed on demand, slabs are carved from it.
+     *  when it runs out, empty slabs are reclaimed from the client holding the most of them,
+     *  so memory migrates to the classes in demand
+     */
+    class slab_reserve_t
+    {
+    public:
+        enum
+        {
+            MAX_CLIENT = 256,
+        };
+
+        slab_reserve_t();
+        ~slab_reserve_t();
+
+        // policy: release_none or release_madvise, for slabs given back
+        int initialize(size_t slab_size, size_t slab_num, const page_option_t& opt = page_option_t(),
+            int policy = slab_allocator_t::release_madvise);
+        // get one slab, NULL if none left
+        void* get();
+        // give back slab s, it must be empty
+        void put(void* s);
+        // true if p is inside reserve
+        bool is_owner(void* p) const
+        {
+            return (char*)p >= base_ && (char*)p < base_ + slab_size_ * slab_num_;
+        }
+
+        // allocators which may be asked for empty slabs
+        int add_client(slab_allocator_t* c);
+        void remove_client(slab_allocator_t* c);
+
+        size_t get_slab_size() const { return slab_size_; }
+        size_t get_slab_num() const { return slab_num_; }
+        // slabs not handed out
+        size_t get_free_num() const { return free_num_ + slab_num_ - bump_; }
+        // slabs taken from clients
+        uint64_t get_reclaim_num() const { return reclaim_num_; }
+
+    private:
+        // deny copy-cons
+        slab_reserve_t(const slab_reserve_t& c);
+        // take empty slabs from the client holding most, return < 0 if no client has any
+        int reclaim();
+
+        char* base_;
+        size_t slab_size_;
+        size_t slab_num_;
+        uint32_t* free_;    // stack of slabs given back
+        size_t free_num_;
+        size_t bump_;       // slabs >= bump_ were never used
+        int policy_;
+        uint64_t reclaim_num_;
+        slab_allocator_t* clients_[MAX_CLIENT];
+        int client_num_;
+    };
+}
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef _WHEELS_SLOT_MAP_H_
+#define _WHEELS_SLOT_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#if __cplusplus >= 201103L
+#include <utility>
+#endif
+
+namespace wheels
+{
+    /*
+     *	slot map, not thread-safe
+     *  objects are kept packed in a dense array, reached through generational handles.
+     *  a handle is slot index + slot version, the version changes when the object is removed,
+     *  so stale handles are detected. remove moves the last object into the hole, so dense
+     *  iteration (get_dense(0..get_size()-1)) is a linear scan, but its order is not stable.
+     *  free slots are linked by index, like multi_queue_t nodes
+     */
+    template<typename T>
+    class slot_map_t
+    {
+    public:
+        // low 32 bits: slot index, high 32 bits: version. 0 is never a valid handle
+        typedef uint64_t handle_t;
+
+        enum
+        {
+            INVALID_IDX = 0xFFFFFFFF,
+        };
+
+        const static handle_t INVALID_HANDLE = 0;
+
+        slot_map_t():
+            slots_(NULL), dense_(NULL), owners_(NULL), capacity_(0), size_(0),
+            free_head_(INVALID_IDX), free_tail_(INVALID_IDX)
+        {
+        }
+
+        ~slot_map_t()
+        {
+            clear();
+            if (slots_)
+            {
+                delete []slots_;
+                slots_ = NULL;
+            }
+
+            if (dense_)
+            {
+                delete [](char*)dense_;
+                dense_ = NULL;
+            }
+
+            if (owners_)
+            {
+                delete []owners_;
+                owners_ = NULL;
+            }
+
+            capacity_ = 0;
+        }
+
+        int initialize(size_t capacity)
+        {
+            if (slots_ || 0 == capacity || capacity >= INVALID_IDX)
+            {
+                return -1;
+            }
+
+            slots_ = new slot_t[capacity];
+            // raw storage, T is constructed on insert
+            dense_ = (T*)new char[sizeof(T) * capacity];
+            owners_ = new uint32_t[capacity];
+            if (NULL == slots_ || NULL == dense_ || NULL == owners_)
+            {
+                return -1;
+            }
+
+            capacity_ = capacity;
+            for (size_t i = 0; i < capacity; ++i)
+            {
+                slots_[i].ver_ = 1;
+            }
+
+            reset_free_list();
+            return 0;
+        }
+
+        // insert a copy of v, return INVALID_HANDLE if full
+        handle_t insert(const T& v)
+        {
+            uint32_t idx = pop_free();
+            if (INVALID_IDX == idx)
+            {
+                return INVALID_HANDLE;
+            }
+
+            new (&dense_[size_]) T(v);
+            return bind(idx);
+        }
+
+#if __cplusplus >= 201103L
+        // construct object with args, return INVALID_HANDLE if full
+        template<typename... Args>
+        handle_t emplace(Args&&... args)
+        {
+            uint32_t idx = pop_free();
+            if (INVALID_IDX == idx)
+            {
+                return INVALID_HANDLE;
+            }
+
+            new (&dense_[size_]) T(std::forward<Args>(args)...);
+            return bind(idx);
+        }
+#endif
+
+        // return object of h, NULL if h is stale or invalid
+        T* get(handle_t h)
+        {
+            uint32_t idx = get_slot(h);
+            return (INVALID_IDX == idx)? NULL: &dense_[slots_[idx].dense_];
+        }
+
+        const T* get(handle_t h) const
+        {
+            uint32_t idx = get_slot(h);
+            return (INVALID_IDX == idx)? NULL: &dense_[slots_[idx].dense_];
+        }
+
+        // remove object of h, the last dense object takes its place. return < 0 if h is stale or invalid
+        int remove(handle_t h)
+        {
+            uint32_t idx = get_slot(h);
+            if (INVALID_IDX == idx)
+            {
+                return -1;
+            }
+
+            uint32_t pos = slots_[idx].dense_;
+            uint32_t last = size_ - 1;
+            if (pos != last)
+            {
+#if __cplusplus >= 201103L
+                dense_[pos] = std::move(dense_[last]);
+#else
+                dense_[pos] = dense_[last];
+#endif
+                owners_[pos] = owners_[last];
+                slots_[owners_[pos]].dense_ = pos;
+            }
+
+            dense_[last].~T();
+            --size_;
+            // version changes on remove, old handles become stale
+            if (0 == ++slots_[idx].ver_)
+            {
+                slots_[idx].ver_ = 1;
+            }
+
+            push_free(idx);
+            return 0;
+        }
+
+        // remove all objects, outstanding handles become stale
+        void clear()
+        {
+            while (size_ > 0)
+            {
+                remove(get_handle(size_ - 1));
+            }
+        }
+
+        /*
+         *	reorder dense objects by slot index and relink free slots in index order.
+         *  afterwards dense order follows handle order, and new objects fill the lowest slots
+         */
+        void compact()
+        {
+            // sort dense positions by owner slot, cycle by cycle. slots_ tells each object's target
+            uint32_t pos = 0;
+            for (size_t i = 0; i < capacity_; ++i)
+            {
+                if (slots_[i].dense_ != INVALID_IDX)
+                {
+                    slots_[i].dense_ = pos++;
+                }
+            }
+
+            for (uint32_t p = 0; p < size_; ++p)
+            {
+                while (slots_[owners_[p]].dense_ != p)
+                {
+                    uint32_t q = slots_[owners_[p]].dense_;
+                    swap_dense(p, q);
+                }
+            }
+
+            reset_free_list();
+        }
+
+        size_t get_size() const { return size_; }
+        size_t get_capacity() const { return capacity_; }
+        bool is_full() const { return size_ >= capacity_; }
+        // i-th object in dense array, i < get_size()
+        T& get_dense(size_t i) { return dense_[i]; }
+        const T& get_dense(size_t i) const { return dense_[i]; }
+        // handle of i-th object in dense array
+        handle_t get_handle(size_t i) const
+        {
+            uint32_t idx = owners_[i];
+            return make_handle(idx, slots_[idx].ver_);
+        }
+
+    private:
+        struct slot_t
+        {
+            uint32_t ver_;
+            uint32_t dense_;    // position in dense_ if used, INVALID_IDX if free
+            uint32_t next_;     // next free slot
+        };
+
+        // deny copy-cons
+        slot_map_t(const slot_map_t& c);
+
+        static inline handle_t make_handle(uint32_t idx, uint32_t ver)
+        {
+            return ((handle_t)ver << 32) | idx;
+        }
+
+        // slot of h, INVALID_IDX if stale or invalid
+        inline uint32_t get_slot(handle_t h) const
+        {
+            uint32_t idx = (uint32_t)h;
+            if (idx >= capacity_ || slots_[idx].ver_ != (uint32_t)(h >> 32) || INVALID_IDX == slots_[idx].dense_)
+            {
+                return INVALID_IDX;
+            }
+
+            return idx;
+        }
+
+        // object at size_ was just constructed for slot idx
+        inline handle_t bind(uint32_t idx)
+        {
+            slots_[idx].dense_ = size_;
+            owners_[size_] = idx;
+            ++size_;
+            return make_handle(idx, slots_[idx].ver_);
+        }
+
+        // free slots are reused in fifo order, delaying version reuse
+        inline uint32_t pop_free()
+        {
+            uint32_t idx = free_head_;
+            if (INVALID_IDX != idx)
+            {
+                free_head_ = slots_[idx].next_;
+                if (INVALID_IDX == free_head_)
+                {
+                    free_tail_ = INVALID_IDX;
+                }
+            }
+
+            return idx;
+        }
+
+        inline void push_free(uint32_t idx)
+        {
+            slots_[idx].dense_ = INVALID_IDX;
+            slots_[idx].next_ = INVALID_IDX;
+            if (INVALID_IDX == free_tail_)
+            {
+                free_head_ = idx;
+            }
+            else
+            {
+                slots_[free_tail_].next_ = idx;
+            }
+
+            free_tail_ = idx;
+        }
+
+        void reset_free_list()
+        {
+            free_head_ = free_tail_ = INVALID_IDX;
+            for (size_t i = 0; i < capacity_; ++i)
+            {
+                if (0 == size_ || INVALID_IDX == slots_[i].dense_)
+                {
+                    push_free(i);
+                }
+            }
+        }
+
+        // swap dense objects p & q, owners_ follows them
+        void swap_dense(uint32_t p, uint32_t q)
+        {
+#if __cplusplus >= 201103L
+            T tmp(std::move(dense_[p]));
+            dense_[p] = std::move(dense_[q]);
+            dense_[q] = std::move(tmp);
+#else
+            T tmp(dense_[p]);
+            dense_[p] = dense_[q];
+            dense_[q] = tmp;
+#endif
+            uint32_t o = owners_[p];
+            owners_[p] = owners_[q];
+            owners_[q] = o;
+        }
+
+        slot_t* slots_;
+        T* dense_;
+        uint32_t* owners_;  // slot index of each dense object
+        size_t capacity_;
+        uint32_t size_;
+        uint32_t free_head_;
+        uint32_t free_tail_;
+    };
+}
+
+#endif
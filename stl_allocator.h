@@ -0,0 +1,108 @@
+#ifndef _WHEELS_STL_ALLOCATOR_H_
+#define _WHEELS_STL_ALLOCATOR_H_
+
+#include <cstddef>
+#include <new>
+#include <allocator.h>
+
+namespace wheels
+{
+    // get sz bytes from a pool
+    template<typename _Alloc>
+    inline void* _pool_alloc(_Alloc* pool, size_t sz)
+    {
+        return pool->alloc(sz);
+    }
+
+    // fixed size pool only serves requests fit in one block, e.g. list/map nodes
+    inline void* _pool_alloc(fixed_size_allocator_t* pool, size_t sz)
+    {
+        return (sz <= pool->get_bsize())? pool->alloc(): NULL;
+    }
+
+    /*
+     *	standard allocator over a wheels pool, e.g.
+     *  stl_allocator_t<std::pair<const int, int> > a(&pool);
+     *  std::map<int, int, std::less<int>, stl_allocator_t<std::pair<const int, int> > > m((std::less<int>()), a);
+     *  _Alloc is any pool with alloc(size_t)/free(void*), like custom_new.h expects,
+     *  or fixed_size_allocator_t for node based containers whose nodes fit in a block.
+     *  it is stateful: copies and rebinds share the pool, and compare equal iff they do
+     */
+    template<typename T, typename _Alloc = allocator_t>
+    class stl_allocator_t
+    {
+    public:
+        typedef T value_type;
+        typedef T* pointer;
+        typedef const T* const_pointer;
+        typedef T& reference;
+        typedef const T& const_reference;
+        typedef size_t size_type;
+        typedef ptrdiff_t difference_type;
+
+        template<typename U>
+        struct rebind
+        {
+            typedef stl_allocator_t<U, _Alloc> other;
+        };
+
+        explicit stl_allocator_t(_Alloc* pool):
+            pool_(pool)
+        {
+        }
+
+        stl_allocator_t(const stl_allocator_t& c):
+            pool_(c.pool_)
+        {
+        }
+
+        template<typename U>
+        stl_allocator_t(const stl_allocator_t<U, _Alloc>& c):
+            pool_(c.get_pool())
+        {
+        }
+
+        pointer address(reference x) const { return &x; }
+        const_pointer address(const_reference x) const { return &x; }
+
+        pointer allocate(size_type n, const void* = 0)
+        {
+            void* p = (n <= max_size())? _pool_alloc(pool_, n * sizeof(T)): NULL;
+            if (NULL == p)
+            {
+                throw std::bad_alloc();
+            }
+
+            return (pointer)p;
+        }
+
+        void deallocate(pointer p, size_type)
+        {
+            pool_->free(p);
+        }
+
+        size_type max_size() const { return (size_type)-1 / sizeof(T); }
+
+        void construct(pointer p, const T& v) { ::new ((void*)p) T(v); }
+        void destroy(pointer p) { p->~T(); }
+
+        _Alloc* get_pool() const { return pool_; }
+
+    private:
+        _Alloc* pool_;
+    };
+
+    template<typename T, typename U, typename _Alloc>
+    inline bool operator==(const stl_allocator_t<T, _Alloc>& l, const stl_allocator_t<U, _Alloc>& r)
+    {
+        return l.get_pool() == r.get_pool();
+    }
+
+    template<typename T, typename U, typename _Alloc>
+    inline bool operator!=(const stl_allocator_t<T, _Alloc>& l, const stl_allocator_t<U, _Alloc>& r)
+    {
+        return l.get_pool() != r.get_pool();
+    }
+}
+
+#endif
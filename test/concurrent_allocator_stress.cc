@@ -0,0 +1,97 @@
+/*
+ *	multi-threaded alloc/free on concurrent_fixed_size_allocator_t.
+ *  every thread stamps the blocks it holds, a block handed to two threads at once breaks the stamp.
+ *  g++ -O2 -I.. concurrent_allocator_stress.cc ../concurrent_allocator.cc -lpthread
+ */
+#include <concurrent_allocator.h>
+#include <pthread.h>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace wheels;
+
+enum
+{
+    BLOCK_SIZE = 32,
+    CAPACITY = 1024,
+    THREAD_NUM = 8,
+    ROUND_NUM = 20000,
+    HOLD_MAX = 64,      // blocks a thread holds at most in one round
+};
+
+static concurrent_fixed_size_allocator_t allocator;
+
+static void* worker(void* arg)
+{
+    long id = (long)arg;
+    unsigned seed = (unsigned)id;
+    void* blocks[HOLD_MAX];
+    for (int r = 0; r < ROUND_NUM; ++r)
+    {
+        int num = 0;
+        int want = 1 + rand_r(&seed) % HOLD_MAX;
+        for (; num < want; ++num)
+        {
+            blocks[num] = allocator.alloc();
+            if (NULL == blocks[num])
+            {
+                break;
+            }
+
+            *(long*)blocks[num] = id;
+        }
+
+        for (int i = 0; i < num; ++i)
+        {
+            if (*(long*)blocks[i] != id || allocator.free(blocks[i]) < 0)
+            {
+                fprintf(stderr, "thread %ld: block %p corrupted\n", id, blocks[i]);
+                abort();
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int main()
+{
+    if (allocator.initialize(BLOCK_SIZE, CAPACITY) < 0)
+    {
+        fprintf(stderr, "initialize failed\n");
+        return 1;
+    }
+
+    pthread_t threads[THREAD_NUM];
+    for (long i = 0; i < THREAD_NUM; ++i)
+    {
+        pthread_create(&threads[i], NULL, worker, (void*)(i + 1));
+    }
+
+    for (int i = 0; i < THREAD_NUM; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // everything returned, and every block can still be handed out exactly once
+    assert(0 == allocator.get_used_num());
+    assert(CAPACITY == allocator.get_free_num());
+    void* blocks[CAPACITY];
+    for (int i = 0; i < CAPACITY; ++i)
+    {
+        blocks[i] = allocator.alloc();
+        assert(NULL != blocks[i]);
+    }
+
+    assert(NULL == allocator.alloc());
+    for (int i = 0; i < CAPACITY; ++i)
+    {
+        assert(0 == allocator.free(blocks[i]));
+        assert(allocator.free(blocks[i]) < 0);
+    }
+
+    assert(0 == allocator.get_used_num());
+    printf("ok\n");
+    return 0;
+}
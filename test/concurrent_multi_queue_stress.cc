@@ -0,0 +1,137 @@
+/*
+ *	multi-threaded moves on concurrent_multi_queue_t.
+ *  threads move nodes between queues at random and look nodes up without lock, at the end every node
+ *  must be in exactly one queue and the counts must match the links. runs the fixed and growable layouts
+ *  g++ -O2 -I.. concurrent_multi_queue_stress.cc -lpthread
+ */
+#include <concurrent_multi_queue.h>
+#include <pthread.h>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace wheels;
+
+enum
+{
+    NODE_NUM = 10000,   // a few mqueue_grow segments
+    QUEUE_NUM = 8,
+    THREAD_NUM = 4,
+    OP_NUM = 100000,
+};
+
+template<int L>
+struct stress_t
+{
+    typedef concurrent_multi_queue_t<int, int, L> queue_type;
+    static queue_type* queue;
+
+    static void* worker(void* arg);
+    static void run();
+};
+
+template<int L>
+typename stress_t<L>::queue_type* stress_t<L>::queue = NULL;
+
+template<int L>
+void* stress_t<L>::worker(void* arg)
+{
+    unsigned seed = (unsigned)(long)arg;
+    for (int i = 0; i < OP_NUM; ++i)
+    {
+        int src = rand_r(&seed) % (QUEUE_NUM + 1);
+        int dst = rand_r(&seed) % (QUEUE_NUM + 1);
+        int idx = rand_r(&seed) % NODE_NUM;
+        int other = rand_r(&seed) % NODE_NUM;
+        // lookups race with nodes being published
+        const int* data = queue->get(idx);
+        if (data && queue->get_idx(data) != idx)
+        {
+            fprintf(stderr, "node %d: get_idx mismatch\n", idx);
+            abort();
+        }
+
+        switch (rand_r(&seed) % 8)
+        {
+        case 0:
+            queue->move(src, dst);
+            break;
+        case 1:
+            queue->move_n(src, dst, 5);
+            break;
+        case 2:
+            queue->move_node(idx, dst);
+            break;
+        case 3:
+            queue->move_node_if(idx, src, dst);
+            break;
+        case 4:
+            queue->swap(idx, other);
+            break;
+        case 5:
+            queue->move_after(idx, other);
+            queue->move_node_head(other, dst);
+            break;
+        case 6:
+            queue->splice(src, dst, idx & 1);
+            break;
+        case 7:
+            queue->splice_range(idx, other, dst, true);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+template<int L>
+void stress_t<L>::run()
+{
+    queue = new queue_type(NODE_NUM, QUEUE_NUM);
+    pthread_t threads[THREAD_NUM];
+    for (long i = 0; i < THREAD_NUM; ++i)
+    {
+        pthread_create(&threads[i], NULL, worker, (void*)(i + 1));
+    }
+
+    for (int i = 0; i < THREAD_NUM; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // walk every queue, a node seen twice or in the wrong queue means a broken link
+    const typename queue_type::queue_type& mq = queue->get_queue();
+    std::vector<int> seen(NODE_NUM, 0);
+    int total = 0;
+    for (int qid = 0; qid <= QUEUE_NUM; ++qid)
+    {
+        int num = 0;
+        for (int i = mq.get_head(qid); i >= 0; i = mq.get_next_id(i))
+        {
+            assert(mq.get_queue_id(i) == qid);
+            assert(0 == seen[i]++);
+            ++num;
+        }
+
+        // queue 0 also counts never-used nodes, which are not linked yet
+        if (qid > 0)
+        {
+            assert(num == queue->get_num(qid));
+        }
+
+        total += queue->get_num(qid);
+    }
+
+    assert(NODE_NUM == total);
+    delete queue;
+    queue = NULL;
+}
+
+int main()
+{
+    stress_t<mqueue_soa>::run();
+    stress_t<mqueue_grow>::run();
+    printf("ok\n");
+    return 0;
+}
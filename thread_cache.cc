@@ -0,0 +1,274 @@
+#include <thread_cache.h>
+#include <cstdlib>
+#include <cstring>
+
+using namespace wheels;
+
+thread_cache_allocator_t::thread_cache_allocator_t():
+    caches_(NULL), msize_(0), inited_(false)
+{
+}
+
+thread_cache_allocator_t::~thread_cache_allocator_t()
+{
+    if (!inited_)
+    {
+        return;
+    }
+
+    // no more thread exit callbacks from now on
+    pthread_key_delete(key_);
+    pthread_mutex_lock(&lock_);
+    while (caches_)
+    {
+        destroy_cache(caches_);
+    }
+
+    pthread_mutex_unlock(&lock_);
+    pthread_mutex_destroy(&lock_);
+    inited_ = false;
+    msize_ = 0;
+}
+
+int thread_cache_allocator_t::initialize( allocator_t::allocator_info_t* allocators, size_t magazine_size, int flags, const page_option_t* popt )
+{
+    if (inited_ || magazine_size <= 0)
+    {
+        return -1;
+    }
+
+    int ret = allocator_.initialize(allocators, flags, popt);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    if (0 != pthread_key_create(&key_, on_thread_exit))
+    {
+        return -1;
+    }
+
+    pthread_mutex_init(&lock_, NULL);
+    msize_ = magazine_size;
+    inited_ = true;
+    return 0;
+}
+
+void* thread_cache_allocator_t::alloc( size_t sz )
+{
+    int cls = allocator_.get_class(sz);
+    if (cls < 0)
+    {
+        // larger than all classes, a large span if alloc_large, NULL otherwise
+        pthread_mutex_lock(&lock_);
+        void* p = allocator_.alloc(sz);
+        pthread_mutex_unlock(&lock_);
+        return p;
+    }
+
+    magazine_t& mag = get_cache()->mags_[cls];
+    if (0 == mag.num_)
+    {
+        void* p = NULL;
+        pthread_mutex_lock(&lock_);
+        refill(mag, cls, (msize_ + 1) / 2, sz);
+        if (0 == mag.num_)
+        {
+            // class exhausted, let shared allocator find a larger one
+            p = allocator_.alloc(sz);
+        }
+
+        pthread_mutex_unlock(&lock_);
+        if (0 == mag.num_)
+        {
+            return p;
+        }
+    }
+
+    void* p = mag.blocks_[--mag.num_];
+    allocator_.clear_cached(p, cls);
+    return p;
+}
+
+int thread_cache_allocator_t::free( void* p )
+{
+    if (NULL == p)
+    {
+        return 0;
+    }
+
+    // only plain blocks handed out and not cached yet. the rest(sampled blocks, double free,
+    // bad pointers) go to the shared allocator, which frees or rejects them
+    int cls = allocator_.mark_cached(p);
+    if (cls < 0)
+    {
+        pthread_mutex_lock(&lock_);
+        int ret = allocator_.free(p);
+        pthread_mutex_unlock(&lock_);
+        return ret;
+    }
+
+    magazine_t& mag = get_cache()->mags_[cls];
+    if (mag.num_ >= msize_)
+    {
+        pthread_mutex_lock(&lock_);
+        flush(mag, cls, (msize_ + 1) / 2);
+        pthread_mutex_unlock(&lock_);
+    }
+
+    mag.blocks_[mag.num_++] = p;
+    return 0;
+}
+
+void* thread_cache_allocator_t::realloc( size_t sz, void* p )
+{
+    int cls = allocator_.get_block_class(p);
+    if (cls < 0)
+    {
+        // large spans are never cached
+        pthread_mutex_lock(&lock_);
+        void* n = allocator_.realloc(sz, p);
+        pthread_mutex_unlock(&lock_);
+        return n;
+    }
+
+    size_t usable = allocator_.get_class_size(cls);
+    if (usable >= sz)
+    {
+        return p;
+    }
+
+    void* n = alloc(sz);
+    if (NULL == n)
+    {
+        return NULL;
+    }
+
+    memcpy(n, p, usable);
+    int ret = free(p);
+    if (ret < 0)
+    {
+        // this should never happen
+        abort();
+    }
+
+    return n;
+}
+
+void thread_cache_allocator_t::flush()
+{
+    thread_cache_t* tc = (thread_cache_t*)pthread_getspecific(key_);
+    if (NULL == tc)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&lock_);
+    for (size_t i = 0; i < allocator_.get_class_num(); ++i)
+    {
+        flush(tc->mags_[i], (int)i, tc->mags_[i].num_);
+    }
+
+    pthread_mutex_unlock(&lock_);
+}
+
+thread_cache_allocator_t::thread_cache_t* thread_cache_allocator_t::create_cache()
+{
+    size_t cnum = allocator_.get_class_num();
+    thread_cache_t* tc = new thread_cache_t;
+    tc->owner_ = this;
+    tc->prev_ = NULL;
+    tc->mags_ = new magazine_t[cnum];
+    tc->blocks_ = new void*[cnum * msize_];
+    for (size_t i = 0; i < cnum; ++i)
+    {
+        tc->mags_[i].num_ = 0;
+        tc->mags_[i].blocks_ = tc->blocks_ + i * msize_;
+    }
+
+    pthread_mutex_lock(&lock_);
+    tc->next_ = caches_;
+    if (caches_)
+    {
+        caches_->prev_ = tc;
+    }
+
+    caches_ = tc;
+    pthread_mutex_unlock(&lock_);
+    pthread_setspecific(key_, tc);
+    return tc;
+}
+
+void thread_cache_allocator_t::destroy_cache( thread_cache_t* tc )
+{
+    for (size_t i = 0; i < allocator_.get_class_num(); ++i)
+    {
+        flush(tc->mags_[i], (int)i, tc->mags_[i].num_);
+    }
+
+    if (tc->prev_)
+    {
+        tc->prev_->next_ = tc->next_;
+    }
+    else
+    {
+        caches_ = tc->next_;
+    }
+
+    if (tc->next_)
+    {
+        tc->next_->prev_ = tc->prev_;
+    }
+
+    delete []tc->blocks_;
+    delete []tc->mags_;
+    delete tc;
+}
+
+void thread_cache_allocator_t::refill( magazine_t& mag, int cls, size_t num, size_t sz )
+{
+    if (num > msize_ - mag.num_)
+    {
+        num = msize_ - mag.num_;
+    }
+
+    size_t got = allocator_.alloc_class_batch(cls, num, mag.blocks_ + mag.num_, sz);
+    for (size_t i = 0; i < got; ++i)
+    {
+        allocator_.mark_cached(mag.blocks_[mag.num_ + i]);
+    }
+
+    mag.num_ += got;
+}
+
+void thread_cache_allocator_t::flush( magazine_t& mag, int cls, size_t num )
+{
+    if (num > mag.num_)
+    {
+        num = mag.num_;
+    }
+
+    // oldest blocks are at the bottom, keep the hot ones. shared pools only take unmarked blocks
+    for (size_t i = 0; i < num; ++i)
+    {
+        allocator_.clear_cached(mag.blocks_[i], cls);
+    }
+
+    if (allocator_.free_batch(num, mag.blocks_) < 0)
+    {
+        // FATAL: should never happen!
+        abort();
+    }
+
+    memmove(mag.blocks_, mag.blocks_ + num, (mag.num_ - num) * sizeof(void*));
+    mag.num_ -= num;
+}
+
+void thread_cache_allocator_t::on_thread_exit( void* p )
+{
+    thread_cache_t* tc = (thread_cache_t*)p;
+    thread_cache_allocator_t* owner = tc->owner_;
+    pthread_mutex_lock(&owner->lock_);
+    owner->destroy_cache(tc);
+    pthread_mutex_unlock(&owner->lock_);
+}
@@ -0,0 +1,82 @@
+#ifndef _WHEELS_THREAD_CACHE_H_
+#define _WHEELS_THREAD_CACHE_H_
+
+#include <allocator.h>
+#include <pthread.h>
+
+namespace wheels
+{
+    /*
+     *	per-thread magazine cache in front of a shared allocator_t
+     *  each thread keeps up to magazine_size free blocks per size class, alloc/free hit the
+     *  magazine without locking. shared pools are locked only to refill/flush half a magazine
+     */
+    class thread_cache_allocator_t
+    {
+    public:
+        thread_cache_allocator_t();
+        ~thread_cache_allocator_t();
+
+        // alloc one block, return the address
+        void* alloc(size_t sz);
+        // dealloc one block, return < 0 if error, coredump if fatal
+        int free(void* p);
+        // realloc, return NULL if oom or error(you can still use p), non-NULL if succ, coredump if fatal
+        void* realloc(size_t sz, void* p);
+
+        // magazine_size: max cached blocks per class per thread, flags/popt: see allocator_t::initialize
+        int initialize(allocator_t::allocator_info_t* allocators, size_t magazine_size,
+            int flags = allocator_t::alloc_default, const page_option_t* popt = NULL);
+        // true if p is inside one of our pools
+        bool is_owner(void* p) const { return allocator_.is_owner(p); }
+        // usable bytes of block p, 0 if p is invalid
+        size_t get_usable_size(void* p)
+        {
+            int cls = allocator_.get_block_class(p);
+            return (cls < 0)? 0: allocator_.get_class_size(cls);
+        }
+        // return blocks cached by calling thread to shared pools
+        void flush();
+
+    private:
+        struct magazine_t
+        {
+            size_t num_;
+            void** blocks_;
+        };
+
+        struct thread_cache_t
+        {
+            thread_cache_allocator_t* owner_;
+            thread_cache_t* prev_;
+            thread_cache_t* next_;
+            magazine_t* mags_;
+            void** blocks_; // shared by all magazines
+        };
+
+        // deny copy-cons
+        thread_cache_allocator_t(const thread_cache_allocator_t& c);
+
+        inline thread_cache_t* get_cache()
+        {
+            thread_cache_t* tc = (thread_cache_t*)pthread_getspecific(key_);
+            return tc? tc: create_cache();
+        }
+
+        thread_cache_t* create_cache();
+        void destroy_cache(thread_cache_t* tc);
+        // move blocks between magazine and shared pool, called with lock_ held. sz: size of the alloc refilling, for stats
+        void refill(magazine_t& mag, int cls, size_t num, size_t sz);
+        void flush(magazine_t& mag, int cls, size_t num);
+        static void on_thread_exit(void* tc);
+
+        allocator_t allocator_;
+        pthread_mutex_t lock_;
+        pthread_key_t key_;
+        thread_cache_t* caches_;
+        size_t msize_;
+        bool inited_;
+    };
+}
+
+#endif